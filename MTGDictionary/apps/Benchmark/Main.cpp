@@ -0,0 +1,314 @@
+//! ----------------------------------------------------------------------------
+//! Main.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+//! Times the matcher and prints one JSON object per line on stdout:
+//!   {"benchmark": ..., "input": ..., "cards": ..., "k": ..., "iterations": ..., "us_per_op": ...}
+//! so results can be collected and compared between releases. Diagnostics go to stderr.
+//! The index comparison adds a "mismatches" field, the exit code is non-zero when any
+//! query got a different answer from the HammingIndex than from the linear scan.
+//!
+//! usage: matcher_benchmark [data directory, defaults to ../MTGDictionary/data]
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "CardMatcher.h"
+
+namespace
+{
+    uint32_t const kNumQueries = 1000;
+    cv::Size const kCardSize(222, 311);
+
+    //! Size of the synthetic catalogs, the last is only used for the index comparison
+    uint32_t const kCatalogSizes[] = { 1000, 10000, 100000, 1000000 };
+    uint32_t const kNumMatcherSizes = 3;
+
+    //! Synthetic cards come in clusters of this many, each up to kMaxClusterFlips bits from the cluster centre
+    uint32_t const kClusterSize = 32;
+    uint32_t const kMaxClusterFlips = 6;
+
+    //! Queries are up to this many bits away from the catalog hash they were made from
+    uint32_t const kMaxQueryFlips = 4;
+
+    char const *kRealInputs[] = { "archon.jpg", "meloku.jpg", "tarmogoyf.jpg" };
+
+    void report(std::string const &_benchmark, std::string const &_input, uint32_t _cards, uint32_t _k, uint32_t _iterations, double _usPerOp)
+    {
+        std::printf("{\"benchmark\": \"%s\", \"input\": \"%s\", \"cards\": %u, \"k\": %u, \"iterations\": %u, \"us_per_op\": %.4f}\n",
+                    _benchmark.c_str(), _input.c_str(), _cards, _k, _iterations, _usPerOp);
+        std::fflush(stdout);
+    }
+
+    //! Same as report, with the number of queries on which the index and the scan disagreed
+    void reportIndex(uint32_t _cards, uint32_t _k, uint32_t _iterations, double _usPerOp, uint32_t _mismatches)
+    {
+        std::printf("{\"benchmark\": \"getCandidateMatches/index\", \"input\": \"\", \"cards\": %u, \"k\": %u, \"iterations\": %u, \"us_per_op\": %.4f, \"mismatches\": %u}\n",
+                    _cards, _k, _iterations, _usPerOp, _mismatches);
+        std::fflush(stdout);
+    }
+
+    //! Calls _op _iterations times without a warm up, returns microseconds per call
+    double timeCold(uint32_t _iterations, std::function<void(uint32_t)> const &_op)
+    {
+        std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < _iterations; i++)
+        {
+            _op(i);
+        }
+        std::chrono::high_resolution_clock::time_point const end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::micro>(end - start).count() / _iterations;
+    }
+
+    //! Calls _op _iterations times after one warm up call, returns microseconds per call
+    double timeOp(uint32_t _iterations, std::function<void(uint32_t)> const &_op)
+    {
+        _op(0);
+        return timeCold(_iterations, _op);
+    }
+
+    //! Fills a catalog with synthetic hashes, no images are involved. Real catalogs are
+    //! not uniform: reprints and related art sit a few bits apart, so cards are drawn in
+    //! small clusters around random centres. Uniform hashes would put the k-th neighbour
+    //! so far away that the index always falls back to its scan.
+    void makeSyntheticCatalog(uint32_t _numCards, std::mt19937_64 &_rng, mtg::CardCatalog &_catalog)
+    {
+        _catalog.cards.assign(_numCards, mtg::Card());
+        _catalog.hashes.resize(_numCards);
+        _catalog.colorHashes.resize(_numCards);
+        _catalog.index.clear();
+
+        uint64_t centre = 0;
+        for (uint32_t c = 0; c < _numCards; c++)
+        {
+            if (c % kClusterSize == 0)
+            {
+                centre = _rng();
+            }
+
+            _catalog.hashes.at(c).words[0] = centre;
+            uint32_t const numFlips = _rng() % (kMaxClusterFlips + 1);
+            for (uint32_t f = 0; f < numFlips; f++)
+            {
+                _catalog.hashes.at(c).words[0] ^= uint64_t(1) << (_rng() % 64);
+            }
+
+            for (uint32_t w = 0; w < mtg::ColorHash::kWords; w++)
+            {
+                _catalog.colorHashes.at(c).words[w] = _rng();
+            }
+        }
+    }
+
+    //! Queries are catalog hashes with a few bits flipped, like a photo of a card would be
+    void makeQueries(mtg::CardCatalog const &_catalog, std::mt19937_64 &_rng, std::vector<mtg::CardHash> &_queries)
+    {
+        _queries.resize(kNumQueries);
+        for (uint32_t q = 0; q < kNumQueries; q++)
+        {
+            _queries.at(q) = _catalog.hashes.at(_rng() % _catalog.hashes.size());
+
+            uint32_t const numFlips = _rng() % (kMaxQueryFlips + 1);
+            for (uint32_t f = 0; f < numFlips; f++)
+            {
+                _queries.at(q).words[0] ^= uint64_t(1) << (_rng() % 64);
+            }
+        }
+    }
+
+    //! Loads the real photos and a noise image, all resized to a rectified card
+    void loadInputs(std::string const &_dataDirectory, std::vector<std::string> &_names, std::vector<cv::Mat> &_images)
+    {
+        for (uint32_t i = 0; i < sizeof(kRealInputs) / sizeof(kRealInputs[0]); i++)
+        {
+            cv::Mat image = cv::imread(_dataDirectory + "/" + kRealInputs[i]);
+            if (image.empty())
+            {
+                std::fprintf(stderr, "Unable to read %s/%s, skipping it.\n", _dataDirectory.c_str(), kRealInputs[i]);
+                continue;
+            }
+
+            cv::resize(image, image, kCardSize);
+            _names.push_back(kRealInputs[i]);
+            _images.push_back(image);
+        }
+
+        cv::Mat noise(kCardSize, CV_8UC3);
+        cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(256));
+        _names.push_back("synthetic");
+        _images.push_back(noise);
+    }
+
+    void benchmarkHashing(std::vector<std::string> const &_names, std::vector<cv::Mat> const &_images)
+    {
+        uint32_t const iterations = 200;
+        for (uint32_t i = 0; i < (uint32_t)_images.size(); i++)
+        {
+            cv::Mat const &image = _images.at(i);
+
+            cv::Mat matHash;
+            report("getImageDCTHash/mat", _names.at(i), 0, 0, iterations,
+                   timeOp(iterations, [&](uint32_t) { mtg::getImageDCTHash(image, matHash); }));
+
+            mtg::PackedHash<64> hash64;
+            report("getImageDCTHash/64", _names.at(i), 0, 0, iterations,
+                   timeOp(iterations, [&](uint32_t) { mtg::getImageDCTHash(image, hash64); }));
+
+            mtg::PackedHash<256> hash256;
+            report("getImageDCTHash/256", _names.at(i), 0, 0, iterations,
+                   timeOp(iterations, [&](uint32_t) { mtg::getImageDCTHash(image, hash256); }));
+
+            mtg::PackedHash<1024> hash1024;
+            report("getImageDCTHash/1024", _names.at(i), 0, 0, iterations,
+                   timeOp(iterations, [&](uint32_t) { mtg::getImageDCTHash(image, hash1024); }));
+
+            mtg::ColorHash colorHash;
+            report("getImageColorHash", _names.at(i), 0, 0, iterations,
+                   timeOp(iterations, [&](uint32_t) { mtg::getImageColorHash(image, colorHash); }));
+        }
+    }
+
+    void benchmarkDistance(std::vector<cv::Mat> const &_images)
+    {
+        uint32_t const iterations = 1000000;
+
+        cv::Mat matHash0, matHash1;
+        mtg::getImageDCTHash(_images.front(), matHash0);
+        mtg::getImageDCTHash(_images.back(), matHash1);
+
+        mtg::CardHash hash0, hash1;
+        mtg::getImageDCTHash(_images.front(), hash0);
+        mtg::getImageDCTHash(_images.back(), hash1);
+
+        // accumulate so the compiler cannot drop the calls
+        volatile float matSum = 0.f;
+        report("getHammingDistance/mat", "", 0, 0, iterations / 100,
+               timeOp(iterations / 100, [&](uint32_t) { matSum = matSum + mtg::getHammingDistance(matHash0, matHash1); }));
+
+        volatile uint32_t packedSum = 0;
+        report("getHammingDistance/64", "", 0, 0, iterations,
+               timeOp(iterations, [&](uint32_t _i) { hash0.words[0] ^= _i & 1; packedSum = packedSum + mtg::getHammingDistance(hash0, hash1); }));
+    }
+
+    void benchmarkMatching(std::vector<std::string> const &_names, std::vector<cv::Mat> const &_images, std::mt19937_64 &_rng)
+    {
+        for (uint32_t s = 0; s < kNumMatcherSizes; s++)
+        {
+            uint32_t const numCards = kCatalogSizes[s];
+
+            mtg::CardCatalog catalog;
+            makeSyntheticCatalog(numCards, _rng, catalog);
+
+            std::vector<mtg::CardHash> queries;
+            makeQueries(catalog, _rng, queries);
+
+            std::vector<mtg::CandidateMatch> candidates;
+            report("getCandidateMatches/hash", "", numCards, 20, kNumQueries,
+                   timeOp(kNumQueries, [&](uint32_t _q) { mtg::getCandidateMatches(queries.at(_q), catalog, 20, candidates); }));
+
+            // end to end: hash the image, then scan
+            for (uint32_t i = 0; i < (uint32_t)_images.size(); i++)
+            {
+                report("getCandidateMatches/image", _names.at(i), numCards, 20, 100,
+                       timeOp(100, [&](uint32_t) { mtg::getCandidateMatches(_images.at(i), catalog, 20, candidates); }));
+
+                report("getRankedMatches/image", _names.at(i), numCards, 20, 100,
+                       timeOp(100, [&](uint32_t) { mtg::getRankedMatches(_images.at(i), catalog, 64, 20, candidates); }));
+            }
+
+            std::vector< std::vector<mtg::CandidateMatch> > batchCandidates;
+            report("getCandidateMatchesBatch/hash", "", numCards, 20, kNumQueries,
+                   timeOp(1, [&](uint32_t) { mtg::getCandidateMatchesBatch(queries, catalog, 20, batchCandidates); }) / kNumQueries);
+        }
+    }
+
+    //! Returns the total number of queries on which the index and the scan disagreed
+    uint32_t benchmarkIndex(std::mt19937_64 &_rng)
+    {
+        uint32_t const topK[] = { 1, 20 };
+        uint32_t totalMismatches = 0;
+
+        for (uint32_t s = 0; s < sizeof(kCatalogSizes) / sizeof(kCatalogSizes[0]); s++)
+        {
+            uint32_t const numCards = kCatalogSizes[s];
+
+            mtg::CardCatalog catalog;
+            makeSyntheticCatalog(numCards, _rng, catalog);
+
+            std::vector<mtg::CardHash> queries;
+            makeQueries(catalog, _rng, queries);
+
+            // a warm up would build the same tables twice, the build is timed cold
+            mtg::CardCatalog indexed = catalog;
+            report("HammingIndex::build", "", numCards, 0, 1,
+                   timeCold(1, [&](uint32_t) { indexed.index.build(indexed.hashes); }));
+
+            for (uint32_t k = 0; k < sizeof(topK) / sizeof(topK[0]); k++)
+            {
+                std::vector< std::vector<mtg::CandidateMatch> > scanResults(kNumQueries), indexResults(kNumQueries);
+                report("getCandidateMatches/scan", "", numCards, topK[k], kNumQueries,
+                       timeOp(kNumQueries, [&](uint32_t _q) { mtg::getCandidateMatches(queries.at(_q), catalog, topK[k], scanResults.at(_q)); }));
+                double const indexTime = timeOp(kNumQueries, [&](uint32_t _q) { mtg::getCandidateMatches(queries.at(_q), indexed, topK[k], indexResults.at(_q)); });
+
+                // both paths must agree exactly, ties included
+                uint32_t mismatches = 0;
+                for (uint32_t q = 0; q < kNumQueries; q++)
+                {
+                    std::vector<mtg::CandidateMatch> const &lhs = scanResults.at(q);
+                    std::vector<mtg::CandidateMatch> const &rhs = indexResults.at(q);
+                    bool same = lhs.size() == rhs.size();
+                    for (uint32_t r = 0; same && r < (uint32_t)lhs.size(); r++)
+                    {
+                        same = lhs.at(r).index == rhs.at(r).index && lhs.at(r).distance == rhs.at(r).distance;
+                    }
+
+                    if (!same)
+                    {
+                        std::fprintf(stderr, "HammingIndex and scan disagree on query %u with %u cards\n", q, numCards);
+                        mismatches++;
+                    }
+                }
+
+                reportIndex(numCards, topK[k], kNumQueries, indexTime, mismatches);
+                totalMismatches += mismatches;
+            }
+        }
+
+        return totalMismatches;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string const dataDirectory = argc > 1 ? argv[1] : "../MTGDictionary/data";
+
+    std::mt19937_64 rng(0x6d7467);
+
+    std::vector<std::string> names;
+    std::vector<cv::Mat> images;
+    loadInputs(dataDirectory, names, images);
+
+    benchmarkHashing(names, images);
+    benchmarkDistance(images);
+    benchmarkMatching(names, images, rng);
+    uint32_t const mismatches = benchmarkIndex(rng);
+    if (mismatches > 0)
+    {
+        std::fprintf(stderr, "HammingIndex and scan disagreed on %u queries.\n", mismatches);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+//! ----------------------------------------------------------------------------
+//! Main.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+//! Runs labelled card photos through rectification and matching without any UI,
+//! and reports recall@1 / recall@5 next to the time spent in every stage.
+//!
+//! usage: recognition_eval [labels file] [catalog directory] [report file]
+//!   defaults: ../MTGDictionary/data/labels.txt ./data recognition_report.jsonl
+//!
+//! The labels name their cards by set folder, every set they name has to be downloaded
+//! into the catalog directory. The report holds one JSON object per photo followed by a
+//! summary object. Nothing is evaluated and the exit code is non-zero when no photo names
+//! a card the catalog holds.
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "CardDetector.h"
+#include "CardMatcher.h"
+#include "JsonUtility.h"
+
+namespace
+{
+    cv::Size const kCardSize(222, 311);
+    uint32_t const kRecallDepth = 5;
+    uint32_t const kCoarseCandidates = 64;
+
+    enum Stage { DECODE, DETECT, RECTIFY, MATCH, RERANK, NUM_STAGES };
+    char const *kStageNames[NUM_STAGES] = { "decode", "detect", "rectify", "match", "rerank" };
+
+    typedef struct Label
+    {
+        std::string photo;
+        std::string expected;
+    } Label;
+
+    typedef struct Result
+    {
+        int32_t coarseRank;
+        int32_t rankedRank;
+        bool inCatalog;
+        bool foundCard;
+        double stageMilliseconds[NUM_STAGES];
+    } Result;
+
+    bool readLabels(std::string const &_path, std::vector<Label> &_labels)
+    {
+        std::ifstream file(_path.c_str());
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        std::string const directory = _path.substr(0, _path.find_last_of("/") + 1);
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line.at(0) == '#')
+            {
+                continue;
+            }
+
+            Label label;
+            std::istringstream fields(line);
+            if (fields >> label.photo >> label.expected)
+            {
+                label.photo = directory + label.photo;
+                _labels.push_back(label);
+            }
+        }
+
+        return true;
+    }
+
+    //! Cards are identified the way they are stored, <set folder>/<file name without extension>
+    std::string getCardId(mtg::Card const &_card)
+    {
+        return _card.setName + "/" + QFileInfo(QString::fromStdString(_card.fileName)).baseName().toStdString();
+    }
+
+    int32_t findRank(std::vector<mtg::CandidateMatch> const &_candidates, int32_t _expectedIndex)
+    {
+        for (int32_t r = 0; r < (int32_t)_candidates.size(); r++)
+        {
+            if ((int32_t)_candidates.at(r).index == _expectedIndex)
+            {
+                return r;
+            }
+        }
+
+        return -1;
+    }
+
+    class StageTimer
+    {
+    public:
+        StageTimer(double &_milliseconds) :
+            mMilliseconds(_milliseconds),
+            mStart(std::chrono::high_resolution_clock::now())
+        {
+        }
+
+        ~StageTimer()
+        {
+            mMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - mStart).count();
+        }
+
+    private:
+        double &mMilliseconds;
+        std::chrono::high_resolution_clock::time_point mStart;
+    };
+
+    //! Finds the card with the scanner's detector cascade, or uses the whole photo when there is none.
+    //! A photo has no background frame to compare against, so only the background free stage runs.
+    void rectifyPhoto(mtg::CardDetector &_detector, cv::Mat const &_photo, Result &_result, cv::Mat &_card)
+    {
+        mtg::CardQuads quads;
+        {
+            StageTimer timer(_result.stageMilliseconds[DETECT]);
+
+            mtg::DetectorInput input;
+            cv::cvtColor(_photo, input.gray, CV_BGR2GRAY);
+            input.color = _photo;
+            input.maxCards = 1;
+            _detector.detect(input, quads);
+        }
+
+        StageTimer timer(_result.stageMilliseconds[RECTIFY]);
+
+        _result.foundCard = !quads.empty();
+        if (_result.foundCard)
+        {
+            mtg::rectifyCard(_photo, quads.front(), _card);
+        }
+        else
+        {
+            cv::resize(_photo, _card, kCardSize);
+        }
+    }
+
+    //! A recall as JSON, null when there was nothing to evaluate
+    std::string getRecall(uint32_t _found, uint32_t _evaluated)
+    {
+        if (_evaluated == 0)
+        {
+            return "null";
+        }
+
+        std::ostringstream recall;
+        recall << double(_found) / _evaluated;
+        return recall.str();
+    }
+
+    void writeResult(std::ofstream &_report, Label const &_label, Result const &_result)
+    {
+        _report << "{\"photo\": \"" << mtg::escapeJson(_label.photo) << "\", \"expected\": \"" << mtg::escapeJson(_label.expected) << "\""
+                << ", \"in_catalog\": " << (_result.inCatalog ? "true" : "false")
+                << ", \"found_card\": " << (_result.foundCard ? "true" : "false")
+                << ", \"coarse_rank\": " << _result.coarseRank
+                << ", \"ranked_rank\": " << _result.rankedRank;
+
+        for (int32_t s = 0; s < NUM_STAGES; s++)
+        {
+            _report << ", \"" << kStageNames[s] << "_ms\": " << _result.stageMilliseconds[s];
+        }
+
+        _report << "}\n";
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string const labelsPath = argc > 1 ? argv[1] : "../MTGDictionary/data/labels.txt";
+    QString const catalogDirectory = argc > 2 ? argv[2] : "./data";
+    std::string const reportPath = argc > 3 ? argv[3] : "recognition_report.jsonl";
+
+    std::vector<Label> labels;
+    if (!readLabels(labelsPath, labels))
+    {
+        mtg_error("Unable to read labels from " << labelsPath << ".");
+        return EXIT_FAILURE;
+    }
+
+    mtg::CardCatalog catalog;
+    mtg::loadAllSets(catalogDirectory, catalog);
+
+    // ids are unique within a catalog, should one repeat the first card keeps it so a tie is not scored as a miss
+    std::map<std::string, int32_t> cardIndex;
+    std::set<std::string> loadedSets;
+    for (int32_t c = 0; c < (int32_t)catalog.cards.size(); c++)
+    {
+        cardIndex.insert(std::make_pair(getCardId(catalog.cards.at(c)), c));
+        loadedSets.insert(catalog.cards.at(c).setName);
+    }
+
+    uint32_t numResolved = 0;
+    std::set<std::string> missingSets;
+    for (int32_t l = 0; l < (int32_t)labels.size(); l++)
+    {
+        std::string const &expected = labels.at(l).expected;
+        std::string const setName = expected.substr(0, expected.find('/'));
+        if (loadedSets.count(setName) == 0)
+        {
+            missingSets.insert(setName);
+        }
+        numResolved += cardIndex.count(expected);
+    }
+
+    for (std::set<std::string>::const_iterator s = missingSets.begin(); s != missingSets.end(); ++s)
+    {
+        mtg_warn("The labels name set " << *s << ", download it into " << catalogDirectory.toStdString() << "/" << *s << " to evaluate its photos.");
+    }
+
+    if (numResolved == 0)
+    {
+        mtg_error("None of the labelled cards is in the catalog, there is no recall to report.");
+        return EXIT_FAILURE;
+    }
+
+    mtg::CardDetector detector;
+    detector.addDetector(std::unique_ptr<mtg::Detector>(new mtg::SquaresDetector()));
+
+    std::ofstream report(reportPath.c_str());
+    if (!report.is_open())
+    {
+        mtg_error("Unable to write report to " << reportPath << ".");
+        return EXIT_FAILURE;
+    }
+
+    uint32_t numProcessed = 0, numEvaluated = 0, numCoarseAt1 = 0, numCoarseAt5 = 0, numRankedAt1 = 0, numRankedAt5 = 0;
+    double totalMilliseconds[NUM_STAGES] = { 0.0 };
+
+    std::vector<mtg::CandidateMatch> candidates;
+    for (int32_t l = 0; l < (int32_t)labels.size(); l++)
+    {
+        Label const &label = labels.at(l);
+
+        Result result;
+        result.coarseRank = -1;
+        result.rankedRank = -1;
+        result.foundCard = false;
+        std::fill(result.stageMilliseconds, result.stageMilliseconds + NUM_STAGES, 0.0);
+
+        std::map<std::string, int32_t>::const_iterator expected = cardIndex.find(label.expected);
+        result.inCatalog = expected != cardIndex.end();
+
+        cv::Mat photo;
+        {
+            StageTimer timer(result.stageMilliseconds[DECODE]);
+            photo = cv::imread(label.photo);
+        }
+
+        if (photo.empty())
+        {
+            mtg_warn("Unable to read " << label.photo << ", skipping it.");
+            continue;
+        }
+
+        cv::Mat card;
+        rectifyPhoto(detector, photo, result, card);
+
+        {
+            StageTimer timer(result.stageMilliseconds[MATCH]);
+            mtg::getCandidateMatches(card, catalog, kCoarseCandidates, candidates);
+        }
+
+        int32_t const expectedIndex = result.inCatalog ? expected->second : -1;
+        result.coarseRank = findRank(candidates, expectedIndex);
+
+        {
+            StageTimer timer(result.stageMilliseconds[RERANK]);
+            mtg::rerankCandidates(card, catalog, candidates);
+        }
+
+        result.rankedRank = findRank(candidates, expectedIndex);
+
+        writeResult(report, label, result);
+        numProcessed++;
+
+        // only photos of cards the catalog holds can count towards recall
+        if (result.inCatalog)
+        {
+            numEvaluated++;
+            numCoarseAt1 += result.coarseRank == 0;
+            numCoarseAt5 += result.coarseRank >= 0 && result.coarseRank < (int32_t)kRecallDepth;
+            numRankedAt1 += result.rankedRank == 0;
+            numRankedAt5 += result.rankedRank >= 0 && result.rankedRank < (int32_t)kRecallDepth;
+        }
+        else
+        {
+            mtg_warn(label.expected << " is not in the catalog, " << label.photo << " does not count towards recall.");
+        }
+
+        for (int32_t s = 0; s < NUM_STAGES; s++)
+        {
+            totalMilliseconds[s] += result.stageMilliseconds[s];
+        }
+    }
+
+    uint32_t const numPhotos = labels.size();
+
+    report << "{\"summary\": true, \"photos\": " << numPhotos << ", \"evaluated\": " << numEvaluated
+           << ", \"catalog_cards\": " << catalog.cards.size()
+           << ", \"coarse_recall_at_1\": " << getRecall(numCoarseAt1, numEvaluated)
+           << ", \"coarse_recall_at_5\": " << getRecall(numCoarseAt5, numEvaluated)
+           << ", \"ranked_recall_at_1\": " << getRecall(numRankedAt1, numEvaluated)
+           << ", \"ranked_recall_at_5\": " << getRecall(numRankedAt5, numEvaluated);
+    for (int32_t s = 0; s < NUM_STAGES; s++)
+    {
+        report << ", \"" << kStageNames[s] << "_ms_per_query\": " << totalMilliseconds[s] / std::max(1u, numProcessed);
+    }
+    report << "}\n";
+
+    mtg_info("Evaluated " << numEvaluated << " of " << numPhotos << " photos against " << catalog.cards.size() << " cards");
+    mtg_info("Report written to " << reportPath);
+
+    if (numEvaluated == 0)
+    {
+        mtg_error("None of the labelled photos could be evaluated, there is no recall to report.");
+        return EXIT_FAILURE;
+    }
+
+    mtg_info("recall@1 " << getRecall(numCoarseAt1, numEvaluated) << " -> " << getRecall(numRankedAt1, numEvaluated) << " after re-ranking");
+    mtg_info("recall@5 " << getRecall(numCoarseAt5, numEvaluated) << " -> " << getRecall(numRankedAt5, numEvaluated) << " after re-ranking");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+//! ----------------------------------------------------------------------------
+//! BoundedQueue.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace mtg
+{
+    //! Depth and backpressure counters of a BoundedQueue
+    typedef struct QueueStats
+    {
+        uint32_t capacity;
+        uint32_t depth;
+        uint32_t maxDepth;
+        uint64_t numPushed;
+        uint64_t numBlocked;
+        uint64_t numDropped;
+        uint64_t depthSum;
+
+        //! Mean depth seen by the items pushed so far, near capacity means the consumer is the bottleneck
+        double getAverageDepth() const
+        {
+            return numPushed > 0 ? double(depthSum) / numPushed : 0.0;
+        }
+    } QueueStats;
+
+    //! A fixed capacity queue between two pipeline stages. A producer that gets ahead blocks
+    //! until the consumer catches up, so a slow stage throttles everything upstream of it.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        BoundedQueue(uint32_t _capacity) :
+            mCapacity(std::max(1u, _capacity)),
+            mClosed(false)
+        {
+            mStats.capacity = mCapacity;
+            mStats.depth = 0;
+            mStats.maxDepth = 0;
+            mStats.numPushed = 0;
+            mStats.numBlocked = 0;
+            mStats.numDropped = 0;
+            mStats.depthSum = 0;
+        }
+
+    public:
+        //! Waits while the queue is full, returns false if the queue was closed
+        bool push(T const &_item)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mItems.size() >= mCapacity && !mClosed)
+            {
+                mStats.numBlocked++;
+                mNotFull.wait(lock, [this]() { return mItems.size() < mCapacity || mClosed; });
+            }
+
+            if (mClosed)
+            {
+                return false;
+            }
+
+            enqueue(_item);
+            return true;
+        }
+
+        //! Never waits, a full queue drops its oldest item to make room. For live sources,
+        //! where a consumer that fell behind should skip ahead rather than work on stale items.
+        bool pushLatest(T const &_item)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mClosed)
+            {
+                return false;
+            }
+
+            while (mItems.size() >= mCapacity && !mItems.empty())
+            {
+                mItems.pop_front();
+                mStats.numDropped++;
+            }
+
+            enqueue(_item);
+            return true;
+        }
+
+        //! Waits for an item, returns false once the queue is closed and drained
+        bool pop(T &_item)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mNotEmpty.wait(lock, [this]() { return !mItems.empty() || mClosed; });
+            return dequeue(_item);
+        }
+
+        //! Never waits, returns false if there is nothing to take
+        bool tryPop(T &_item)
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            return dequeue(_item);
+        }
+
+        //! Refuses further pushes and wakes every waiter, whatever is queued can still be popped
+        void close()
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mClosed = true;
+            mNotEmpty.notify_all();
+            mNotFull.notify_all();
+        }
+
+        bool isClosed() const
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            return mClosed;
+        }
+
+        mtg::QueueStats getStats() const
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mtg::QueueStats stats = mStats;
+            stats.depth = mItems.size();
+            return stats;
+        }
+
+    private:
+        void enqueue(T const &_item)
+        {
+            mItems.push_back(_item);
+
+            uint32_t const depth = mItems.size();
+            mStats.numPushed++;
+            mStats.depthSum += depth;
+            mStats.maxDepth = std::max(mStats.maxDepth, depth);
+
+            mNotEmpty.notify_one();
+        }
+
+        bool dequeue(T &_item)
+        {
+            if (mItems.empty())
+            {
+                return false;
+            }
+
+            _item = mItems.front();
+            mItems.pop_front();
+
+            mNotFull.notify_one();
+            return true;
+        }
+
+    private:
+        mutable std::mutex mMutex;
+        std::condition_variable mNotEmpty;
+        std::condition_variable mNotFull;
+        std::deque<T> mItems;
+        uint32_t mCapacity;
+        bool mClosed;
+        mtg::QueueStats mStats;
+    };
+}
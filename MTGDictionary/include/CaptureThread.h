@@ -0,0 +1,73 @@
+//! ----------------------------------------------------------------------------
+//! CaptureThread.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <thread>
+
+#include "FrameSource.h"
+
+namespace mtg
+{
+    //! Reads a frame source on its own thread so slow processing never stalls capture.
+    //! Frames go through a lock-free ring of three preallocated slots: the capture
+    //! thread owns one, the consumer owns one, and the third holds the newest frame
+    //! not yet consumed. Publishing or consuming a frame is a single atomic exchange,
+    //! a frame replaced before anyone consumed it is counted as dropped. A consumer
+    //! that is ahead of the camera sleeps on a condition variable until the next frame.
+    class CaptureThread
+    {
+    public:
+        CaptureThread(mtg::FrameSource *_source);
+        ~CaptureThread();
+
+    public:
+        void start();
+        void stop();
+
+        //! Hands out the newest captured frame, waiting for one if nothing new arrived since
+        //! the last call. The frame stays valid until the next call, returns false once stopped.
+        bool getLatestFrame(cv::Mat &_frame, int64_t &_timestampMicroseconds);
+
+        uint64_t getCapturedFrames() const;
+        uint64_t getDroppedFrames() const;
+
+    private:
+        typedef struct Slot
+        {
+            cv::Mat frame;
+            int64_t timestampMicroseconds;
+        } Slot;
+
+        static uint32_t const kNumSlots = 3;
+        static uint32_t const kSlotMask = 0x3;
+        static uint32_t const kFreshFlag = 0x4;
+
+        void captureLoop();
+
+    private:
+        mtg::FrameSource *mSource;
+        std::thread mThread;
+        Slot mSlots[kNumSlots];
+        std::atomic<uint32_t> mPending;
+        std::atomic<bool> mRunning;
+        std::atomic<uint64_t> mCapturedFrames;
+        std::atomic<uint64_t> mDroppedFrames;
+        std::mutex mWaitMutex;
+        std::condition_variable mFrameCondition;
+        uint32_t mWriteSlot;
+        uint32_t mReadSlot;
+    };
+}
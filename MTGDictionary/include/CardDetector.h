@@ -11,20 +11,115 @@
 
 #pragma once
 
+#include <memory>
 #include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
 
 namespace mtg
 {
+    //! The corners of every card found, ordered { TL, BL, BR, TR }
+    typedef std::vector< std::vector<cv::Point2f> > CardQuads;
+
+    //! What a detector gets to look at, all images cover the same region of the frame
+    typedef struct DetectorInput
+    {
+        cv::Mat gray;
+        cv::Mat grayBase;
+        cv::Mat color;
+        int32_t maxCards;
+    } DetectorInput;
+
+    //! How often a detector ran, how often it found something and what that cost
+    typedef struct DetectorStats
+    {
+        std::string name;
+        uint64_t numRuns;
+        uint64_t numHits;
+        uint64_t numConfident;
+        uint64_t numChosen;
+        uint64_t totalMicroseconds;
+
+        float getHitRate() const
+        {
+            return numRuns > 0 ? float(numHits) / float(numRuns) : 0.f;
+        }
+
+        double getAverageMilliseconds() const
+        {
+            return numRuns > 0 ? totalMicroseconds * 1e-3 / numRuns : 0.0;
+        }
+    } DetectorStats;
+
+    //! One way of finding cards in a region of a frame
+    class Detector
+    {
+    public:
+        virtual ~Detector();
+
+    public:
+        virtual char const *getName() const = 0;
+
+        //! Fills _cards with at most _input.maxCards cards and returns how sure it is of them, in [0, 1]
+        virtual float detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards) = 0;
+    };
+
+    //! Convex hull around the edges of what differs from the background, cheap but easily
+    //! thrown off by a hand or a second object in the region
+    class HullDetector : public Detector
+    {
+    public:
+        virtual char const *getName() const;
+        virtual float detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards);
+    };
+
+    //! mtg::findSquaresParallel over every color plane and threshold level, expensive but does
+    //! not depend on the background model at all. With _stopEarly a search for a single card
+    //! ends as soon as one clean outline was found. Above 0 pyramid levels the search runs
+    //! coarse to fine, see mtg::findSquaresCoarseToFine. Its confidence comes from how square
+    //! the worst corner is and how close the sides come to a card's 63 x 88 proportions.
+    class SquaresDetector : public Detector
+    {
+    public:
+        SquaresDetector(int32_t _threshold = 50, int32_t _levels = 11, bool _stopEarly = true, int32_t _pyramidLevels = 0);
+
+    public:
+        virtual char const *getName() const;
+        virtual float detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards);
+
+    private:
+        int32_t mThreshold;
+        int32_t mLevels;
+        bool mStopEarly;
+        int32_t mPyramidLevels;
+    };
+
+    //! Runs its detectors in the order they were added, cheapest first. The first result at
+    //! or above the minimum confidence wins, later detectors only run when the earlier ones
+    //! found nothing or were unsure. Without a confident result the most confident one is kept.
     class CardDetector
     {
     public:
-        CardDetector();
+        CardDetector(float _minConfidence = 0.5f);
 
     public:
-        void detectCard(cv::Mat const &_gray, cv::Mat const &_grayBase, std::vector<cv::Point2f> &_corners);
-        void getRectifiedCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners);
+        void addDetector(std::unique_ptr<mtg::Detector> _detector);
+
+        //! Returns the confidence of the result in _cards, 0 if nothing was found
+        float detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards);
+
+        //! One entry per detector, in cascade order
+        std::vector<mtg::DetectorStats> const &getStats() const;
 
     private:
-        void reorderCornerVertices(std::vector<cv::Point2f> &corners);
+        float mMinConfidence;
+        std::vector< std::unique_ptr<mtg::Detector> > mDetectors;
+        std::vector<mtg::DetectorStats> mStats;
     };
-}
\ No newline at end of file
+
+    //! Warps the card inside _corners (ordered { TL, BL, BR, TR }) out of _inputColor into a 222x311 snapshot
+    void rectifyCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners, cv::Mat &_card);
+
+    //! Reorders the corners of a card to always contain { TL, BL, BR, TR }
+    void reorderCornerVertices(std::vector<cv::Point2f> &_corners);
+}
@@ -11,14 +11,16 @@
 
 #pragma once
 
-#include <map>
+#include <functional>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <string>
 #include <QtCore>
 
+#include "HammingIndex.h"
 #include "Log.h"
+#include "PerceptualHash.h"
 
 std::string const kAllAvailableSets[] = {
     "BFZ", "BNG", "DTK",
@@ -26,18 +28,109 @@ std::string const kAllAvailableSets[] = {
     "M15", "ORI", "THS"
 };
 
+//! Catalogs at least this large are searched through a HammingIndex instead of a linear scan
+uint32_t const kHammingIndexMinCards = 16384;
+
+//! Upper bound on how many candidates the color hash stage will look at per query
+uint32_t const kMaxRerankCandidates = 256;
+
 namespace mtg
 {
+    //! A catalog entry. Its image is not kept resident, callers that need the pixels decode
+    //! them on demand through mtg::ImageCache.
     typedef struct Card
     {
         std::string fileName;
         std::string setName;
-        cv::Mat image;
-        cv::Mat dctHash;
+        int64_t modifiedTime;
+        int64_t fileSize;
     } Card;
 
-    void loadAllSets(QString const &_directory, std::vector<mtg::Card> &_cards);
+    //! Cards and their hashes are kept in parallel arrays, so the hashes can be
+    //! scanned as one flat block of memory: hashes[i] and colorHashes[i] belong to cards[i].
+    //! The index is only built for large catalogs, see kHammingIndexMinCards.
+    typedef struct CardCatalog
+    {
+        std::vector<mtg::Card> cards;
+        std::vector<mtg::CardHash> hashes;
+        std::vector<mtg::ColorHash> colorHashes;
+        mtg::HammingIndex index;
+    } CardCatalog;
+
+    //! Called as images are hashed while loading, with the number done so far and the number to do
+    typedef std::function<void(uint32_t _done, uint32_t _total)> LoadProgressCallback;
+
+    //! Loads every card image found in the set folders under _directory, reusing the
+    //! hashes stored in the catalog file for images that have not changed since.
+    //! New or changed images are decoded and hashed on all cores of the global ThreadPool.
+    void loadAllSets(QString const &_directory, mtg::CardCatalog &_catalog, bool _useCatalogFile = true,
+                     mtg::LoadProgressCallback const &_progress = mtg::LoadProgressCallback());
+
+    //! The 8x8 DCT hash of a card image as a binary (0/255) matrix
     void getImageDCTHash(cv::Mat const &_source, cv::Mat &_hash);
+
+    //! The DCT hash of a card image packed into Bits bits, Bits must be a square number
+    template <uint32_t Bits>
+    void getImageDCTHash(cv::Mat const &_source, mtg::PackedHash<Bits> &_hash);
+
+    //! The re-ranking descriptor of a card image, see mtg::ColorHash
+    void getImageColorHash(cv::Mat const &_source, mtg::ColorHash &_hash);
+
+    //! Number of differing pixels between two binary hash matrices of the same size
     float getHammingDistance(cv::Mat const &_image0, cv::Mat const &_image1);
-    void getCandidateMatches(cv::Mat const &_cardImage, std::vector<mtg::Card> const &_cache, std::vector<mtg::Card> &_candidates);
+
+    //! Returns the _k catalog entries closest to the card image, sorted by ascending distance.
+    //! Cards at equal distance are all kept (ordered by index) up to _k results in total.
+    void getCandidateMatches(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _k, std::vector<mtg::CandidateMatch> &_candidates);
+
+    //! Overloaded version of getCandidateMatches for an already computed hash
+    void getCandidateMatches(mtg::CardHash const &_hash, mtg::CardCatalog const &_catalog, uint32_t _k, std::vector<mtg::CandidateMatch> &_candidates);
+
+    //! Throughput of one getCandidateMatchesBatch call
+    typedef struct BatchStats
+    {
+        uint32_t numQueries;
+        double hashMilliseconds;
+        double matchMilliseconds;
+        double queriesPerSecond;
+    } BatchStats;
+
+    //! Matches many card images at once: the images are hashed in parallel, then the catalog
+    //! is split into slices across the pool and walked once in cache sized blocks, each
+    //! compared against every query while hot; the per-slice results are merged at the end
+    void getCandidateMatchesBatch(std::vector<cv::Mat> const &_cardImages, mtg::CardCatalog const &_catalog, uint32_t _k,
+                                  std::vector< std::vector<mtg::CandidateMatch> > &_candidates, mtg::BatchStats *_stats = NULL);
+
+    //! Overloaded version of getCandidateMatchesBatch for already computed hashes
+    void getCandidateMatchesBatch(std::vector<mtg::CardHash> const &_hashes, mtg::CardCatalog const &_catalog, uint32_t _k,
+                                  std::vector< std::vector<mtg::CandidateMatch> > &_candidates, mtg::BatchStats *_stats = NULL);
+
+    //! Cost of the second matching stage, filled in by rerankCandidates
+    typedef struct RerankStats
+    {
+        uint32_t numReranked;
+        double descriptorMilliseconds;
+        double rerankMilliseconds;
+    } RerankStats;
+
+    //! Re-orders coarse candidates by their color hash distance to the card image, setting
+    //! refinedDistance. Only the first kMaxRerankCandidates candidates are considered.
+    void rerankCandidates(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, std::vector<mtg::CandidateMatch> &_candidates, mtg::RerankStats *_stats = NULL);
+
+    //! Overloaded version of rerankCandidates for an already computed color hash
+    void rerankCandidates(mtg::ColorHash const &_colorHash, mtg::CardCatalog const &_catalog, std::vector<mtg::CandidateMatch> &_candidates, mtg::RerankStats *_stats = NULL);
+
+    //! Two stage cascade: the pHash scan picks _coarseK candidates, the color hash re-ranks them and the best _k are kept.
+    //! Both _coarseK and _k are capped at kMaxRerankCandidates.
+    void getRankedMatches(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _coarseK, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches, mtg::RerankStats *_stats = NULL);
+
+    //! Overloaded version of getRankedMatches for already computed hashes
+    void getRankedMatches(mtg::CardHash const &_hash, mtg::ColorHash const &_colorHash, mtg::CardCatalog const &_catalog, uint32_t _coarseK, uint32_t _k,
+                          std::vector<mtg::CandidateMatch> &_matches, mtg::RerankStats *_stats = NULL);
+
+    //! Returns every catalog entry within _radius of the card image, sorted by ascending distance
+    void getCandidateMatchesWithin(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _radius, std::vector<mtg::CandidateMatch> &_candidates);
+
+    //! Overloaded version of getCandidateMatchesWithin for an already computed hash
+    void getCandidateMatchesWithin(mtg::CardHash const &_hash, mtg::CardCatalog const &_catalog, uint32_t _radius, std::vector<mtg::CandidateMatch> &_candidates);
 }
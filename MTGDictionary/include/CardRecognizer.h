@@ -0,0 +1,75 @@
+//! ----------------------------------------------------------------------------
+//! CardRecognizer.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <functional>
+
+#include "CardMatcher.h"
+#include "EvidenceAccumulator.h"
+
+namespace mtg
+{
+    //! A card the recognizer settled on
+    typedef struct Recognition
+    {
+        uint64_t frame;
+        uint64_t cardId;
+        uint32_t slot;
+        mtg::EvidenceDecision decision;
+        std::vector<mtg::CandidateMatch> candidates;
+
+        //! The rectified snapshot that settled the decision
+        cv::Mat snapshot;
+    } Recognition;
+
+    //! Turns scanner snapshots into recognized cards. Every slot of a card id, the position of
+    //! a snapshot within its frame, is fused with the earlier snapshots of the same slot until
+    //! the evidence decides, and is reported once. Decided slots are no longer matched, the
+    //! remaining ones of a frame are matched in parallel.
+    class CardRecognizer
+    {
+    public:
+        CardRecognizer(mtg::CardCatalog const &_catalog, uint32_t _coarseK = 64, uint32_t _k = 20);
+
+    public:
+        //! Appends the cards settled by the snapshots of one frame to _recognized
+        void addSnapshots(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, std::vector<mtg::Recognition> &_recognized);
+
+        //! Overloaded version of addSnapshots for snapshots hashed beforehand by hashSnapshots
+        void addSnapshots(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, std::vector<mtg::CardHash> const &_hashes,
+                          std::vector<mtg::ColorHash> const &_colorHashes, std::vector<mtg::Recognition> &_recognized);
+
+        //! The hashes addSnapshots matches with, one of each per card, computed on every core
+        static void hashSnapshots(std::vector<cv::Mat> const &_cards, std::vector<mtg::CardHash> &_hashes, std::vector<mtg::ColorHash> &_colorHashes);
+
+        //! False once every card in view is decided, their snapshots need not be matched
+        bool needsSnapshots(uint64_t _cardId) const;
+
+        uint64_t getNumRecognized() const;
+        double getFramesPerDecision() const;
+
+    private:
+        //! Matches a slot of the current card into its candidates
+        typedef std::function<void(uint32_t, std::vector<mtg::CandidateMatch> &)> SlotMatcher;
+
+        void addMatches(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, SlotMatcher const &_match, std::vector<mtg::Recognition> &_recognized);
+
+    private:
+        mtg::CardCatalog const &mCatalog;
+        uint32_t mCoarseK;
+        uint32_t mK;
+        uint64_t mCardId;
+        uint64_t mNumRecognized;
+        uint64_t mNumDecisionFrames;
+        std::vector<mtg::EvidenceAccumulator> mEvidence;
+    };
+}
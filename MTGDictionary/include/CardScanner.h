@@ -13,49 +13,191 @@
 
 #include <algorithm>
 #include <cmath>
-#include <deque>
+#include <memory>
 #include <numeric>
 #include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "CaptureThread.h"
+#include "CardDetector.h"
+#include "FramePool.h"
+#include "FrameSource.h"
+#include "OpenCVUtility.h"
 
 namespace mtg
 {
+    //! Tunables for CardScanner, the defaults reproduce the original single threaded behaviour
+    struct ScannerOptions
+    {
+        ScannerOptions();
+
+        //! Read the camera on a dedicated thread and always process the newest frame
+        bool threadedCapture;
+
+        //! Gate motion on a small area-averaged copy of every frame, the full resolution frame
+        //! is only converted once movement was seen
+        bool lowResolutionMotion;
+
+        //! Width of the motion gate frames, the height follows the camera aspect ratio
+        int32_t motionWidth;
+
+        //! Keep a running average of the background, blended while the scene is static and
+        //! still looks like the background, so lighting drift stops triggering detectCard
+        bool adaptiveBackground;
+
+        //! Weight of a new static frame in the running average
+        float backgroundLearningRate;
+
+        //! The motion resolution model is blended every static frame, the full resolution one
+        //! only every this many static frames (at a correspondingly higher rate), at least 1
+        int32_t backgroundFullUpdateInterval;
+
+        //! A static frame correlating with the background above this shows the empty scene: it
+        //! ends a motion event as a false alarm, and only such frames blend into the background
+        float backgroundSimilarityThreshold;
+
+        //! Run detectCard only inside the padded bounding box of what differs from the background
+        bool cropToMotion;
+
+        //! Once a card is found, follow its corners with sparse optical flow and hand out a
+        //! fresh snapshot every frame, detectCard only runs again when tracking is lost or due, see maxTrackedFrames.
+        //! Only a detection that found a single card is tracked, several cards are handed out
+        //! where they were found for as long as nothing moves.
+        bool trackCards;
+
+        //! A card is followed for at most this many frames before the detectors run again to verify
+        //! it is still there, a card found in the same place keeps its id. Several cards are only
+        //! handed out for this many frames. 0 tracks without limit.
+        int32_t maxTrackedFrames;
+
+        //! Above 1 every separate changed component is searched for a card, instead of one
+        //! hull around all edges, and up to this many cards are returned per frame
+        int32_t maxCards;
+
+        //! Fall back to mtg::findSquares when the hull around the changed edges finds no card,
+        //! or only one it is less than minDetectionConfidence sure of
+        bool squaresFallback;
+        float minDetectionConfidence;
+
+        //! Run the findSquares fallback on a frame pyrDown'ed this many times and refine only the
+        //! corners at full resolution, 0 searches at full resolution
+        int32_t squaresPyramidLevels;
+    };
+
+    //! Counters describing how much work the scanner did and how much of it was wasted
+    typedef struct ScannerStats
+    {
+        uint64_t numFrames;
+        uint64_t numMotionEvents;
+        uint64_t numFalseTriggers;
+        uint64_t numDetections;
+        uint64_t numCardsFound;
+        uint64_t numBackgroundUpdates;
+        uint64_t numTrackedFrames;
+        uint64_t numTrackingLost;
+        uint64_t numReverifications;
+
+        //! Share of motion events that ended without a card, either as a false alarm or an empty detectCard
+        float getFalseTriggerRate() const
+        {
+            return numMotionEvents > 0 ? float(numFalseTriggers) / float(numMotionEvents) : 0.f;
+        }
+    } ScannerStats;
+
     class CardScanner
     {
     public:
-        CardScanner(cv::VideoCapture *_camera);
+        CardScanner(mtg::FrameSource *_source, mtg::ScannerOptions const &_options = mtg::ScannerOptions());
+        ~CardScanner();
 
     public:
         bool checkForCard(cv::Mat &_detectedCard);
 
+        //! Like checkForCard, but hands out every card found in the frame, at most ScannerOptions::maxCards
+        uint32_t checkForCards(std::vector<cv::Mat> &_detectedCards);
+
+        //! Like checkForCards, but stops short of rectification and hands out the corners of every
+        //! card together with the frame they were found in, see mtg::rectifyCard. The pooled frame
+        //! is not reused for as long as _frame references it.
+        uint32_t checkForQuads(std::vector< std::vector<cv::Point2f> > &_quads, mtg::FramePtr &_frame);
+
+        //! Capture time of the frame the last checkForCard call worked on, in steady clock microseconds
+        int64_t getFrameTimestamp() const;
+
+        //! Frames the capture thread replaced before they were processed, always 0 without threaded capture
+        uint64_t getDroppedFrames() const;
+
+        mtg::ScannerStats const &getStats() const;
+
+        //! Runs, hit rate and latency of every detector of the cascade, cheapest first
+        std::vector<mtg::DetectorStats> const &getDetectorStats() const;
+
+        //! Identifies the card the last snapshot shows, it changes whenever detectCard finds a card
+        //! and stays the same for every snapshot tracked from that detection
+        uint64_t getCardId() const;
+
+        bool isTracking() const;
+
+        //! True once the frame source is exhausted, no more cards will be found
+        bool isFinished() const;
+
     private:
-        void grabFrame();
+        void processFrame();
+        bool grabFrame();
         void updateBackground();
+        void blendBackground();
         void checkForMovement();
 
+        //! Follows the tracked corners into the current frame, returns false once they are lost
+        bool trackCard();
+
+        //! The image motion and background similarity are measured on, small or full resolution gray
+        cv::Mat const &getMotionGray(mtg::FramePtr const &_frame);
+
+        //! Full resolution bounding box of the pixels that differ from the background, padded so
+        //! the card outline stays inside, or the whole frame if cropping is off or nothing changed
+        cv::Rect getMotionRegion();
+
+        //! Mean squared difference between the frame and the running average of the earlier ones,
+        //! one comparison per frame however much history the average holds
         int32_t calculateBiggestDifference();
         float calculateBackgroundSimilarity();
 
-        void detectCard(cv::Mat const &_gray, cv::Mat const &_grayBase, std::vector<cv::Point2f> &_corners);
-        void getRectifiedCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners);
-        void reorderCornerVertices(std::vector<cv::Point2f> &corners);
+        void rectifyCards(std::vector< std::vector<cv::Point2f> > const &_quads);
 
     private:
-        std::deque<cv::Mat> mRecentFrames;
-        std::deque<cv::Mat> mRecentFramesGray;
-        cv::VideoCapture *mCamera;
+        mtg::ScannerOptions mOptions;
+        std::unique_ptr<mtg::CaptureThread> mCapture;
+        mtg::FrameSource *mSource;
         int32_t  mRecentFramesMax;
-        int32_t  mNumPixels;
-        cv::Mat  mLastFrame;
-        cv::Mat  mLastFrameGray;
-        cv::Mat  mLastFrameFlipped;
-        cv::Mat  mSnapshot;
+        mtg::FramePool mFramePool;
+        std::vector<mtg::FramePtr> mRecentFrames;
+        cv::Mat  mMotionAverage;
+        mtg::FramePtr mFrame;
+        std::vector< std::vector<cv::Point2f> > mQuads;
+        std::vector<cv::Mat> mSnapshots;
         cv::Mat  mBackground;
         cv::Mat  mBackgroundGray;
-        cv::Mat  mBackgroundFlipped;
+        cv::Mat  mBackgroundSmallGray;
+        cv::Mat  mBackgroundModel;
+        cv::Mat  mBackgroundSmallModel;
+        mtg::ImageMoments mBackgroundMoments;
+        mtg::ScannerStats mStats;
+        mtg::CardDetector mDetector;
+        std::vector<cv::Point2f> mTrackedCorners;
+        cv::Mat  mTrackGray;
+        float    mTrackedArea;
+        int32_t  mTrackedFrames;
+        std::vector<cv::Point2f> mVerifiedCorners;
+        std::vector< std::vector<cv::Point2f> > mHeldQuads;
+        uint64_t mCardId;
+        bool     mTracking;
+        int32_t  mStaticFrames;
         cv::Size mImageSize;
+        cv::Size mMotionSize;
+        int64_t  mFrameTimestamp;
         bool mHasMoved;
-        bool mFound;
+        bool mFinished;
     };
 }
@@ -0,0 +1,59 @@
+//! ----------------------------------------------------------------------------
+//! CatalogFile.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <QtCore>
+
+#include "CardMatcher.h"
+
+//! Name of the catalog file written next to the set folders
+QString const kCatalogFileName = "catalog.idx";
+
+namespace mtg
+{
+    //! A memory mapped catalog file. The hashes are handed out as views into the mapping,
+    //! nothing is copied until a caller decides to keep a record.
+    class CatalogFile
+    {
+    public:
+        CatalogFile();
+        ~CatalogFile();
+
+    public:
+        //! Maps and validates the file, returns false if it is missing, truncated, corrupt
+        //! or from another version
+        bool open(QString const &_path);
+        void close();
+
+        uint32_t size() const;
+
+        //! Name, set and file stamps of record _r, as stored when the file was written
+        void getCard(uint32_t _r, mtg::Card &_card) const;
+
+        //! Views into the mapping, valid until close
+        mtg::CardHash const &getHash(uint32_t _r) const;
+        mtg::ColorHash const &getColorHash(uint32_t _r) const;
+
+        //! True if the image of record _r could not be decoded, it has no hashes then
+        bool isUnreadable(uint32_t _r) const;
+
+    private:
+        QFile mFile;
+        uchar const *mData;
+        uint32_t mCount;
+    };
+
+    //! Writes _catalog to disk, then renames it over any existing file in a single atomic step.
+    //! The _unreadable images are recorded too, so they are not decoded again while unchanged.
+    bool writeCatalogFile(QString const &_path, mtg::CardCatalog const &_catalog,
+                          std::vector<mtg::Card> const &_unreadable = std::vector<mtg::Card>());
+}
@@ -0,0 +1,56 @@
+//! ----------------------------------------------------------------------------
+//! Display.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <string>
+
+#include "RecognitionPipeline.h"
+
+namespace mtg
+{
+    //! Owns every window. HighGUI backends such as Qt only work on the thread that owns the
+    //! application, so all of it runs on the main thread: the caller polls the pipeline and
+    //! calls update once per tick, and processing never waits on the screen.
+    class Display
+    {
+    public:
+        //! Shows the newest frame of _pipeline in a "Camera Feed" window _previewFps times per
+        //! second, with the processing rate and latency drawn over it. 0 turns the preview off.
+        Display(mtg::RecognitionPipeline const &_pipeline, double _previewFps);
+
+    public:
+        //! Shows _image in window _window, drawn on the next update
+        void showImage(std::string const &_window, cv::Mat const &_image);
+
+        //! Draws the preview and pumps the window events, without waiting on a key
+        void update();
+
+        //! Sleeps until the next tick of the preview rate, ticks that were missed are skipped
+        void waitForNextTick();
+
+    private:
+        void drawPreview(mtg::FramePtr const &_frame, int64_t _now);
+
+    private:
+        mtg::RecognitionPipeline const &mPipeline;
+        double mPreviewFps;
+        int64_t mInterval;
+        int64_t mNextTick;
+        cv::Mat mPreview;
+        int64_t mRateStart;
+        uint64_t mRateFramesStart;
+        uint64_t mRateCapturedStart;
+        double mScanFps;
+        double mCaptureFps;
+    };
+}
@@ -0,0 +1,76 @@
+//! ----------------------------------------------------------------------------
+//! EvidenceAccumulator.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "HammingIndex.h"
+
+//! Summed distance the leader has to be ahead of the runner up by before a decision is made
+uint32_t const kDefaultEvidenceMargin = 48;
+
+//! A decision is forced after this many snapshots, confident or not
+uint32_t const kDefaultEvidenceMaxFrames = 8;
+
+namespace mtg
+{
+    //! The outcome of fusing the snapshots of one card
+    typedef struct EvidenceDecision
+    {
+        uint32_t index;
+        uint32_t margin;
+        uint32_t numFrames;
+        bool confident;
+    } EvidenceDecision;
+
+    //! Fuses the candidate lists of consecutive snapshots of the same card. Distances are summed
+    //! per catalog card across snapshots, a card missing from a snapshot's list is charged that
+    //! list's worst distance. A decision is reached as soon as the leader is kDefaultEvidenceMargin
+    //! ahead in total, so a clean snapshot decides on its own and a blurry one gathers more frames.
+    class EvidenceAccumulator
+    {
+    public:
+        EvidenceAccumulator(uint32_t _margin = kDefaultEvidenceMargin, uint32_t _maxFrames = kDefaultEvidenceMaxFrames);
+
+    public:
+        //! Forgets all evidence, to be called whenever the card in view changes
+        void reset();
+
+        //! Adds the ranked candidates of one snapshot, returns true once a decision was reached.
+        //! Uses the re-ranked distance of candidates that went through rerankCandidates.
+        bool addCandidates(std::vector<mtg::CandidateMatch> const &_candidates);
+
+        bool isDecided() const;
+        uint32_t getNumFrames() const;
+
+        //! The current leader, meaningful once at least one snapshot was added
+        mtg::EvidenceDecision getDecision() const;
+
+    private:
+        typedef struct Evidence
+        {
+            uint64_t distanceSum;
+            uint64_t penaltySumWhenSeen;
+        } Evidence;
+
+        uint64_t getScore(Evidence const &_evidence) const;
+
+    private:
+        uint32_t mMargin;
+        uint32_t mMaxFrames;
+        uint32_t mNumFrames;
+        uint64_t mPenaltySum;
+        bool mDecided;
+        std::unordered_map<uint32_t, Evidence> mEvidence;
+    };
+}
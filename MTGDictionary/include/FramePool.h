@@ -0,0 +1,92 @@
+//! ----------------------------------------------------------------------------
+//! FramePool.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <vector>
+
+namespace mtg
+{
+    //! A camera frame and the images derived from it. Derived images are only made on
+    //! first use, and a recycled frame converts into the buffers it already owns.
+    //! Threads sharing a frame may all ask for its derived images, the first one makes them.
+    class Frame
+    {
+    public:
+        Frame();
+
+    public:
+        //! Forgets the derived images of the previous contents, keeping their memory.
+        //! Only called while nothing else holds the frame.
+        void reset();
+
+        cv::Mat const &getGray();
+
+        //! Every caller of one frame has to ask for the same _size
+        cv::Mat const &getSmallGray(cv::Size const &_size);
+
+    public:
+        cv::Mat color;
+        int64_t timestampMicroseconds;
+
+    private:
+        std::mutex mMutex;
+        cv::Mat mGray;
+        cv::Mat mSmall;
+        cv::Mat mSmallGray;
+        bool mHasGray;
+        bool mHasSmallGray;
+    };
+
+    typedef std::shared_ptr<mtg::Frame> FramePtr;
+
+    //! A fixed set of frames handed out by reference count. Releasing the last reference puts
+    //! the frame back on a locked free list, so whatever the last holder wrote happens before
+    //! the next acquire hands it out again. The reference count blocks are recycled the same way,
+    //! so once every frame was used at the camera resolution, acquiring and filling frames no
+    //! longer touches the heap.
+    class FramePool
+    {
+    public:
+        FramePool(uint32_t _numFrames);
+
+    public:
+        //! Returns a free frame, the pool only grows if every frame is still referenced
+        mtg::FramePtr acquire();
+
+        uint32_t size() const;
+
+    private:
+        //! Outlives the pool for as long as any of its frames is still referenced
+        typedef struct Storage
+        {
+            ~Storage();
+
+            std::mutex mutex;
+            std::vector< std::unique_ptr<mtg::Frame> > frames;
+            std::vector<mtg::Frame *> freeFrames;
+
+            //! Reference count blocks of released frames, all of blockSize bytes
+            std::vector<void *> freeBlocks;
+            size_t blockSize;
+        } Storage;
+
+        //! Allocates the reference count blocks of the frames from the free blocks of Storage
+        template <typename T>
+        class BlockAllocator;
+
+        std::shared_ptr<Storage> mStorage;
+    };
+}
@@ -0,0 +1,75 @@
+//! ----------------------------------------------------------------------------
+//! FrameSource.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+namespace mtg
+{
+    //! Where the scanner gets its frames from, a live camera or a recorded session
+    class FrameSource
+    {
+    public:
+        virtual ~FrameSource();
+
+    public:
+        //! Reads the next frame, returns false once the source is exhausted
+        virtual bool read(cv::Mat &_frame) = 0;
+
+        //! Size of the frames to come, empty if the source cannot tell before the first read
+        virtual cv::Size getFrameSize() const;
+
+        //! Capture time of the frame last read in steady clock microseconds, 0 if the source does
+        //! not stamp its frames and the reader should take the time it read them instead
+        virtual int64_t getFrameTimestamp() const;
+    };
+
+    //! Frames of a cv::VideoCapture, a camera or a video file
+    class VideoFrameSource : public FrameSource
+    {
+    public:
+        VideoFrameSource(cv::VideoCapture *_capture);
+
+    public:
+        virtual bool read(cv::Mat &_frame);
+        virtual cv::Size getFrameSize() const;
+
+    private:
+        cv::VideoCapture *mCapture;
+    };
+
+    //! The images of a directory in file name order, one per frame. The first image sets the
+    //! frame size, the scanner compares every frame with the ones before it, so any image of
+    //! another size is resized to it with a warning.
+    class DirectoryFrameSource : public FrameSource
+    {
+    public:
+        DirectoryFrameSource(QString const &_directory);
+
+    public:
+        virtual bool read(cv::Mat &_frame);
+
+        //! Size of the first image, empty before it was read
+        virtual cv::Size getFrameSize() const;
+
+        uint32_t size() const;
+
+    private:
+        QString mDirectory;
+        QStringList mFiles;
+        int32_t mNext;
+        cv::Size mFrameSize;
+    };
+}
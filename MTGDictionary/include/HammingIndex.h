@@ -0,0 +1,95 @@
+//! ----------------------------------------------------------------------------
+//! HammingIndex.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "PerceptualHash.h"
+
+namespace mtg
+{
+    //! A catalog entry returned by the matcher, index is into CardCatalog::cards.
+    //! refinedDistance is only set once the candidate went through rerankCandidates.
+    typedef struct CandidateMatch
+    {
+        uint32_t index;
+        uint32_t distance;
+        uint32_t refinedDistance;
+    } CandidateMatch;
+
+    //! Orders by distance, then by catalog index so that ties stay deterministic
+    inline bool operator<(mtg::CandidateMatch const &_lhs, mtg::CandidateMatch const &_rhs)
+    {
+        return _lhs.distance < _rhs.distance || (_lhs.distance == _rhs.distance && _lhs.index < _rhs.index);
+    }
+
+    //! Offers a candidate to a bounded max-heap of the _k best (smallest) matches
+    inline void pushCandidate(std::vector<mtg::CandidateMatch> &_heap, uint32_t _k, mtg::CandidateMatch const &_candidate)
+    {
+        if (_heap.size() < _k)
+        {
+            _heap.push_back(_candidate);
+            std::push_heap(_heap.begin(), _heap.end());
+        }
+        else if (_candidate < _heap.front())
+        {
+            std::pop_heap(_heap.begin(), _heap.end());
+            _heap.back() = _candidate;
+            std::push_heap(_heap.begin(), _heap.end());
+        }
+    }
+
+    //! Multi-index hashing over card hashes. Each hash is split into four 16-bit
+    //! substrings with one lookup table per substring; any hash within distance r
+    //! of a query matches it in at least one substring within distance r / 4, so
+    //! only a small neighbourhood of every table has to be probed and verified.
+    //! The tables hold indices only, the hashes stay in the catalog and are passed
+    //! to every search; they must be the same hashes the index was built from.
+    class HammingIndex
+    {
+    public:
+        HammingIndex();
+
+    public:
+        void build(std::vector<mtg::CardHash> const &_hashes);
+        void clear();
+        bool empty() const;
+        uint32_t size() const;
+
+        //! Returns every hash within _radius of _query, sorted by ascending distance
+        void radiusSearch(std::vector<mtg::CardHash> const &_hashes, mtg::CardHash const &_query, uint32_t _radius, std::vector<mtg::CandidateMatch> &_matches) const;
+
+        //! Returns the _k hashes closest to _query, identical to a brute force scan.
+        //! Falls back to scanning when the k-th neighbour is too far away for the tables to help.
+        void nearestSearch(std::vector<mtg::CardHash> const &_hashes, mtg::CardHash const &_query, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches) const;
+
+    private:
+        static uint32_t const kNumTables = 4;
+        static uint32_t const kSubstringBits = 16;
+        static uint32_t const kNumBuckets = 1 << kSubstringBits;
+        static uint32_t const kScanBlockSize = 1024;
+        static uint32_t const kScanFallbackFraction = 16;
+
+        //! Visits every hash whose closest substring is exactly _substringDistance away
+        template <typename Visitor>
+        void probe(mtg::CardHash const *_hashes, mtg::CardHash const &_query, uint32_t _substringDistance, Visitor &_visitor) const;
+
+        //! Brute force top-k over the indexed hashes
+        void scanNearest(mtg::CardHash const *_hashes, mtg::CardHash const &_query, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches) const;
+
+    private:
+        uint32_t mSize;
+        std::vector<uint32_t> mBucketStart[kNumTables];
+        std::vector<uint32_t> mBucketItems[kNumTables];
+    };
+}
@@ -0,0 +1,57 @@
+//! ----------------------------------------------------------------------------
+//! ImageCache.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+//! Default budget for decoded card images, roughly 150 full size card scans
+size_t const kDefaultImageCacheBytes = 32 * 1024 * 1024;
+
+namespace mtg
+{
+    //! Decodes card images on demand and keeps the most recently used ones,
+    //! evicting the least recently used once the decoded bytes exceed the budget
+    class ImageCache
+    {
+    public:
+        ImageCache(size_t _maxBytes);
+
+    public:
+        //! Returns the decoded image, an empty matrix if the file could not be read
+        cv::Mat getImage(std::string const &_fileName);
+
+        void clear();
+        size_t getResidentBytes() const;
+        uint64_t getHits() const;
+        uint64_t getMisses() const;
+
+    private:
+        typedef std::pair<std::string, cv::Mat> Entry;
+        typedef std::list<Entry> EntryList;
+
+        void evict();
+
+    private:
+        mutable std::mutex mMutex;
+        EntryList mEntries;
+        std::unordered_map<std::string, EntryList::iterator> mLookup;
+        size_t mMaxBytes;
+        size_t mResidentBytes;
+        uint64_t mHits;
+        uint64_t mMisses;
+    };
+}
@@ -0,0 +1,45 @@
+//! ----------------------------------------------------------------------------
+//! JsonUtility.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+namespace mtg
+{
+    //! Escapes _value for use inside a JSON string
+    inline std::string escapeJson(std::string const &_value)
+    {
+        std::string escaped;
+        for (size_t c = 0; c < _value.size(); c++)
+        {
+            unsigned char const character = _value.at(c);
+            if (character == '"' || character == '\\')
+            {
+                escaped += '\\';
+                escaped += character;
+            }
+            else if (character < 0x20)
+            {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", character);
+                escaped += code;
+            }
+            else
+            {
+                escaped += character;
+            }
+        }
+
+        return escaped;
+    }
+}
@@ -12,11 +12,12 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <opencv2/core/core.hpp>
 
 namespace mtg
 {
-    float sumSquared(cv::Mat const &lhs, cv::Mat const &rhs)
+    inline float sumSquared(cv::Mat const &lhs, cv::Mat const &rhs)
     {
         cv::Mat tmp;
         cv::subtract(lhs, rhs, tmp);
@@ -24,7 +25,7 @@ namespace mtg
         return cv::sum(tmp)[0];
     }
 
-    float coeffNormed(cv::Mat const &lhs, cv::Mat const &rhs)
+    inline float coeffNormed(cv::Mat const &lhs, cv::Mat const &rhs)
     {
         cv::Mat tmp0, tmp1;
         lhs.convertTo(tmp0, CV_32F, 1.f / 255.f);
@@ -38,10 +39,72 @@ namespace mtg
         cv::pow(tmp0, 2.f, norm0);
         cv::pow(tmp1, 2.f, norm1);
 
-        return tmp0.dot(tmp1) / std::sqrtf(cv::sum(norm1)[0] * cv::sum(norm1)[0]);
+        return tmp0.dot(tmp1) / std::sqrt(cv::sum(norm0)[0] * cv::sum(norm1)[0]);
     }
 
-    void flipImage(cv::Mat const &source, cv::Mat &target)
+    //! First and second order statistics of an 8-bit single channel image
+    typedef struct ImageMoments
+    {
+        double mean;
+        double sumSquaredDeviation;
+    } ImageMoments;
+
+    inline void getImageMoments(cv::Mat const &_image, mtg::ImageMoments &_moments)
+    {
+        CV_Assert(_image.type() == CV_8UC1);
+
+        uint64_t sum = 0, sumSquares = 0;
+        for (int32_t j = 0; j < _image.rows; j++)
+        {
+            uint8_t const *row = _image.ptr<uint8_t>(j);
+            uint32_t rowSum = 0, rowSumSquares = 0;
+            for (int32_t i = 0; i < _image.cols; i++)
+            {
+                rowSum += row[i];
+                rowSumSquares += uint32_t(row[i]) * row[i];
+            }
+            sum += rowSum;
+            sumSquares += rowSumSquares;
+        }
+
+        double const numPixels = (double)_image.total();
+        _moments.mean = sum / numPixels;
+        _moments.sumSquaredDeviation = sumSquares - sum * _moments.mean;
+    }
+
+    //! Same result as coeffNormed, but against a reference whose moments are already known.
+    //! A single pass of integer sums over both images, nothing is allocated.
+    inline float coeffNormed(cv::Mat const &_reference, mtg::ImageMoments const &_referenceMoments, cv::Mat const &_image)
+    {
+        CV_Assert(_reference.type() == CV_8UC1 && _image.type() == CV_8UC1 && _reference.size() == _image.size());
+
+        uint64_t sum = 0, sumSquares = 0, sumProducts = 0;
+        for (int32_t j = 0; j < _image.rows; j++)
+        {
+            uint8_t const *reference = _reference.ptr<uint8_t>(j);
+            uint8_t const *row = _image.ptr<uint8_t>(j);
+            uint32_t rowSum = 0, rowSumSquares = 0, rowSumProducts = 0;
+            for (int32_t i = 0; i < _image.cols; i++)
+            {
+                rowSum += row[i];
+                rowSumSquares += uint32_t(row[i]) * row[i];
+                rowSumProducts += uint32_t(row[i]) * reference[i];
+            }
+            sum += rowSum;
+            sumSquares += rowSumSquares;
+            sumProducts += rowSumProducts;
+        }
+
+        // sum((a - meanA)(b - meanB)) = sum(ab) - meanA * sum(b), likewise for the squares
+        double const mean = sum / (double)_image.total();
+        double const covariance = sumProducts - _referenceMoments.mean * sum;
+        double const sumSquaredDeviation = sumSquares - sum * mean;
+        double const denominator = std::sqrt(_referenceMoments.sumSquaredDeviation * sumSquaredDeviation);
+
+        return denominator > 0.0 ? float(covariance / denominator) : 0.f;
+    }
+
+    inline void flipImage(cv::Mat const &source, cv::Mat &target)
     {
         cv::flip(source, target, -1);
     }
@@ -0,0 +1,94 @@
+//! ----------------------------------------------------------------------------
+//! PerceptualHash.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <opencv2/core/core.hpp>
+
+namespace mtg
+{
+    //! Bit-packed perceptual hash, stored as contiguous 64-bit words so that a
+    //! flat array of hashes can be scanned without any per-card indirection
+    template <uint32_t Bits>
+    struct PackedHash
+    {
+        static_assert(Bits > 0 && Bits % 64 == 0, "PackedHash width must be a multiple of 64 bits");
+
+        static uint32_t const kBits  = Bits;
+        static uint32_t const kWords = Bits / 64;
+
+        uint64_t words[kWords];
+    };
+
+    //! The hash stored for every card in the catalog (8x8 DCT coefficients)
+    typedef PackedHash<64> CardHash;
+
+    //! The re-ranking descriptor, 16x16 DCT coefficients for each of the B, G and R channels
+    typedef PackedHash<768> ColorHash;
+
+    //! Returns the number of set bits in a 64-bit word
+    inline uint32_t popCount(uint64_t _word)
+    {
+        return (uint32_t)__builtin_popcountll(_word);
+    }
+
+    //! Packs a binary (0/255) single channel matrix into a hash, row major, one bit per pixel
+    template <uint32_t Bits>
+    void packHash(cv::Mat const &_bits, PackedHash<Bits> &_hash)
+    {
+        CV_Assert(_bits.type() == CV_8UC1 && (uint32_t)_bits.total() == Bits);
+
+        std::memset(_hash.words, 0, sizeof(_hash.words));
+
+        uint32_t bit = 0;
+        for (int32_t j = 0; j < _bits.rows; j++)
+        {
+            uint8_t const *row = _bits.ptr<uint8_t>(j);
+            for (int32_t i = 0; i < _bits.cols; i++, bit++)
+            {
+                if (row[i] != 0)
+                {
+                    _hash.words[bit / 64] |= uint64_t(1) << (bit % 64);
+                }
+            }
+        }
+    }
+
+    //! Computes the hamming distance between two packed hashes
+    template <uint32_t Bits>
+    inline uint32_t getHammingDistance(PackedHash<Bits> const &_hash0, PackedHash<Bits> const &_hash1)
+    {
+        uint32_t sum = 0;
+        for (uint32_t w = 0; w < PackedHash<Bits>::kWords; w++)
+        {
+            sum += mtg::popCount(_hash0.words[w] ^ _hash1.words[w]);
+        }
+
+        return sum;
+    }
+
+    //! Computes the hamming distance between _query and every hash of a flat
+    //! array of _count hashes, each _words wide, writing one distance per hash
+    void scanHammingDistances(uint64_t const *_query, uint32_t _words, uint64_t const *_hashes, size_t _count, uint32_t *_distances);
+
+    //! Typed front end to scanHammingDistances for a contiguous array of packed hashes
+    template <uint32_t Bits>
+    void scanHammingDistances(PackedHash<Bits> const &_query, PackedHash<Bits> const *_hashes, size_t _count, uint32_t *_distances)
+    {
+        static_assert(sizeof(PackedHash<Bits>) == PackedHash<Bits>::kWords * sizeof(uint64_t), "PackedHash must not be padded");
+
+        mtg::scanHammingDistances(_query.words, PackedHash<Bits>::kWords,
+                                  reinterpret_cast<uint64_t const *>(_hashes), _count, _distances);
+    }
+}
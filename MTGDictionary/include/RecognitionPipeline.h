@@ -0,0 +1,150 @@
+//! ----------------------------------------------------------------------------
+//! RecognitionPipeline.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "BoundedQueue.h"
+#include "CardRecognizer.h"
+#include "CardScanner.h"
+
+namespace mtg
+{
+    //! Tunables for RecognitionPipeline
+    struct PipelineOptions
+    {
+        PipelineOptions();
+
+        //! Items every queue between two stages holds before the producer has to wait
+        uint32_t queueCapacity;
+
+        //! Never let capture wait on the scanner, the oldest queued frames are dropped instead.
+        //! For live cameras, a recorded session wants every frame processed.
+        bool dropFrames;
+
+        //! The scanner runs on its own thread, its capture thread option is ignored
+        mtg::ScannerOptions scanner;
+    };
+
+    //! Queue depths and the time every stage spent working, as opposed to waiting on its queues
+    typedef struct PipelineStats
+    {
+        mtg::QueueStats frames;
+        mtg::QueueStats quads;
+        mtg::QueueStats cards;
+        mtg::QueueStats hashes;
+        mtg::QueueStats recognitions;
+        uint64_t captureMicroseconds;
+        uint64_t scanMicroseconds;
+        uint64_t rectifyMicroseconds;
+        uint64_t hashMicroseconds;
+        uint64_t matchMicroseconds;
+        uint64_t numSkippedFrames;
+        mtg::ScannerStats scanner;
+        std::vector<mtg::DetectorStats> detectors;
+    } PipelineStats;
+
+    //! Runs capture, scanning, rectification, hashing and matching each on their own thread, connected
+    //! by bounded queues, so that consecutive frames are in different stages at the same time.
+    //! The slowest stage sets the throughput, a full queue holds back every stage before it.
+    //! Captured frames come from a pool, the scanner copies them into buffers of its own.
+    class RecognitionPipeline
+    {
+    public:
+        RecognitionPipeline(mtg::FrameSource *_source, mtg::CardCatalog const &_catalog, mtg::PipelineOptions const &_options = mtg::PipelineOptions());
+        ~RecognitionPipeline();
+
+    public:
+        void start();
+
+        //! Stops every stage, whatever is still queued is discarded
+        void stop();
+
+        //! Waits for the next recognized card, returns false once the source is exhausted and drained
+        bool popRecognition(mtg::Recognition &_recognition);
+
+        //! Never waits, returns false if no card was recognized since the last call
+        bool tryPopRecognition(mtg::Recognition &_recognition);
+
+        //! True once the source is exhausted and every recognized card was popped
+        bool isFinished() const;
+
+        //! The frame the scanner last worked on, empty before the first one
+        mtg::FramePtr getLatestFrame() const;
+
+        mtg::PipelineStats getStats() const;
+
+    private:
+        typedef struct ScannedFrame
+        {
+            uint64_t frame;
+            uint64_t cardId;
+            mtg::FramePtr image;
+            std::vector< std::vector<cv::Point2f> > quads;
+        } ScannedFrame;
+
+        typedef struct RectifiedFrame
+        {
+            uint64_t frame;
+            uint64_t cardId;
+            std::vector<cv::Mat> cards;
+        } RectifiedFrame;
+
+        typedef struct HashedFrame
+        {
+            uint64_t frame;
+            uint64_t cardId;
+            std::vector<cv::Mat> cards;
+            std::vector<mtg::CardHash> hashes;
+            std::vector<mtg::ColorHash> colorHashes;
+        } HashedFrame;
+
+        void captureLoop();
+        void scanLoop();
+        void rectifyLoop();
+        void hashLoop();
+        void matchLoop();
+
+    private:
+        mtg::FrameSource *mSource;
+        mtg::PipelineOptions mOptions;
+        mtg::FramePool mCapturePool;
+        mtg::BoundedQueue<mtg::FramePtr> mFrames;
+        mtg::BoundedQueue<ScannedFrame> mQuads;
+        mtg::BoundedQueue<RectifiedFrame> mCards;
+        mtg::BoundedQueue<HashedFrame> mHashes;
+        mtg::BoundedQueue<mtg::Recognition> mRecognitions;
+        std::unique_ptr<mtg::FrameSource> mScannerSource;
+        mtg::CardScanner mScanner;
+        mtg::CardRecognizer mRecognizer;
+        std::thread mCaptureThread;
+        std::thread mScanThread;
+        std::thread mRectifyThread;
+        std::thread mHashThread;
+        std::thread mMatchThread;
+        std::atomic<bool> mRunning;
+        std::atomic<uint64_t> mDecidedCardId;
+        std::atomic<uint64_t> mCaptureMicroseconds;
+        std::atomic<uint64_t> mScanMicroseconds;
+        std::atomic<uint64_t> mRectifyMicroseconds;
+        std::atomic<uint64_t> mHashMicroseconds;
+        std::atomic<uint64_t> mMatchMicroseconds;
+        std::atomic<uint64_t> mSkippedFrames;
+        mutable std::mutex mLatestMutex;
+        mtg::FramePtr mLatestFrame;
+        mtg::ScannerStats mScannerStats;
+        std::vector<mtg::DetectorStats> mDetectorStats;
+    };
+}
@@ -25,12 +25,27 @@ namespace mtg
     typedef std::vector< cv::Point > Square;
     typedef std::vector<   Square  > SquaresVector;
 
+    //! Squares with subpixel corners, as refined by findSquaresCoarseToFine
+    typedef std::vector< cv::Point2f    > SubpixelSquare;
+    typedef std::vector< SubpixelSquare > SubpixelSquaresVector;
+
     //! Finds the cosine of angle between vectors from p0->p1 and from p0->p2
     float getAngleBetweenVectors(cv::Point p1, cv::Point p2, cv::Point p0);
 
     //! Returns sequence of squares detected on the input image
     void findSquares(cv::Mat const &input_image, int32_t threshold, int32_t levels, mtg::SquaresVector &squares);
 
+    //! findSquares with every (color plane, threshold level) pair searched in parallel on the global
+    //! thread pool, and the copies of a square found by several of them merged into one. With
+    //! stop_early, pairs not yet started are skipped once one found a near perfect card outline.
+    void findSquaresParallel(cv::Mat const &input_image, int32_t threshold, int32_t levels, mtg::SquaresVector &squares, bool stop_early = false);
+
+    //! findSquaresParallel on an image pyrDown'ed pyramid_levels times, each level a quarter of the
+    //! pixels of the one above. Only the corners of the squares found there are refined at full
+    //! resolution, each in a small window around its scaled up coarse position. Refined squares
+    //! keep their subpixel corners and have to pass findSquares' checks again at full resolution.
+    void findSquaresCoarseToFine(cv::Mat const &input_image, int32_t threshold, int32_t levels, int32_t pyramid_levels, mtg::SubpixelSquaresVector &squares, bool stop_early = false);
+
     //! Returns sequence of lines detected on the input image
     void findLines(cv::Mat const &input_image, std::vector<cv::Vec4i> &lines);
 
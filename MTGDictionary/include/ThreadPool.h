@@ -0,0 +1,73 @@
+//! ----------------------------------------------------------------------------
+//! ThreadPool.h
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mtg
+{
+    //! A fixed set of worker threads that run the iterations of a parallel loop.
+    //! The calling thread works alongside the pool, iterations are handed out
+    //! one at a time so uneven work items still balance across the cores.
+    //! Loops started concurrently from several threads are queued and the
+    //! workers move on to the next one as soon as a loop has no iterations left.
+    class ThreadPool
+    {
+    public:
+        //! _numThreads of 0 sizes the pool to the number of hardware threads
+        ThreadPool(uint32_t _numThreads = 0);
+        ~ThreadPool();
+
+    public:
+        //! Calls _body(i) for every i in [0, _count) and returns once all calls finished.
+        //! Runs serially when called from inside the pool. If a call throws, no further
+        //! iterations are started and the first exception is rethrown on the caller
+        //! once the calls already running have returned.
+        void parallelFor(uint32_t _count, std::function<void(uint32_t)> const &_body);
+
+        //! Number of threads taking part in a parallelFor, the caller included
+        uint32_t getNumThreads() const;
+
+        //! Process wide pool shared by the catalog, matcher and detector
+        static mtg::ThreadPool &getGlobalPool();
+
+    private:
+        //! One parallelFor in flight, it lives on the stack of the calling thread
+        typedef struct Job
+        {
+            std::function<void(uint32_t)> const *body;
+            uint32_t count;
+            std::atomic<uint32_t> next;
+            uint32_t numWorkers;
+            std::exception_ptr error;
+        } Job;
+
+        void workerLoop();
+        void runIterations(mtg::ThreadPool::Job &_job);
+        void removeJob(mtg::ThreadPool::Job const *_job);
+
+    private:
+        std::vector<std::thread> mWorkers;
+        std::mutex mMutex;
+        std::condition_variable mWakeCondition;
+        std::condition_variable mDoneCondition;
+        std::deque<mtg::ThreadPool::Job *> mJobs;
+        bool mShutdown;
+    };
+}
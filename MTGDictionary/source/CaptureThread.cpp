@@ -0,0 +1,139 @@
+//! ----------------------------------------------------------------------------
+//! CaptureThread.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "CaptureThread.h"
+
+#include <chrono>
+
+#include "Log.h"
+
+mtg::CaptureThread::CaptureThread(mtg::FrameSource *_source) :
+    mSource(_source),
+    mPending(1),
+    mRunning(false),
+    mCapturedFrames(0),
+    mDroppedFrames(0),
+    mWriteSlot(0),
+    mReadSlot(2)
+{
+    // preallocate every slot at the source resolution, the capture then reuses the buffers
+    cv::Size const frameSize = mSource->getFrameSize();
+    for (uint32_t s = 0; s < kNumSlots; s++)
+    {
+        if (frameSize.area() > 0)
+        {
+            mSlots[s].frame.create(frameSize, CV_8UC3);
+        }
+        mSlots[s].timestampMicroseconds = 0;
+    }
+}
+
+mtg::CaptureThread::~CaptureThread()
+{
+    stop();
+}
+
+void mtg::CaptureThread::start()
+{
+    if (mRunning)
+    {
+        return;
+    }
+
+    mRunning = true;
+    mThread = std::thread(&mtg::CaptureThread::captureLoop, this);
+}
+
+void mtg::CaptureThread::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mRunning = false;
+    }
+    mFrameCondition.notify_all();
+
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+}
+
+bool mtg::CaptureThread::getLatestFrame(cv::Mat &_frame, int64_t &_timestampMicroseconds)
+{
+    {
+        std::unique_lock<std::mutex> lock(mWaitMutex);
+        mFrameCondition.wait(lock, [this]() { return (mPending.load() & kFreshFlag) || !mRunning; });
+    }
+
+    // a frame captured before the source ended is still handed out
+    if (!(mPending.load() & kFreshFlag))
+    {
+        return false;
+    }
+
+    // give back the slot we held and take the newest one
+    mReadSlot = mPending.exchange(mReadSlot) & kSlotMask;
+
+    _frame = mSlots[mReadSlot].frame;
+    _timestampMicroseconds = mSlots[mReadSlot].timestampMicroseconds;
+    return true;
+}
+
+uint64_t mtg::CaptureThread::getCapturedFrames() const
+{
+    return mCapturedFrames;
+}
+
+uint64_t mtg::CaptureThread::getDroppedFrames() const
+{
+    return mDroppedFrames;
+}
+
+void mtg::CaptureThread::captureLoop()
+{
+    while (mRunning)
+    {
+        Slot &slot = mSlots[mWriteSlot];
+        if (!mSource->read(slot.frame))
+        {
+            mtg_info("Frame source is exhausted, ending capture.");
+            {
+                std::lock_guard<std::mutex> lock(mWaitMutex);
+                mRunning = false;
+            }
+            mFrameCondition.notify_all();
+            break;
+        }
+
+        // the source's own stamp where it has one, the same the direct path uses
+        slot.timestampMicroseconds = mSource->getFrameTimestamp();
+        if (slot.timestampMicroseconds == 0)
+        {
+            slot.timestampMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        mCapturedFrames++;
+
+        // publish the frame, and continue in whichever slot was pending before
+        uint32_t const previous = mPending.exchange(mWriteSlot | kFreshFlag);
+        mWriteSlot = previous & kSlotMask;
+        if (previous & kFreshFlag)
+        {
+            mDroppedFrames++;
+        }
+
+        // taking the lock orders the publish before a consumer's check, so the wake up is never lost
+        {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+        }
+        mFrameCondition.notify_one();
+    }
+}
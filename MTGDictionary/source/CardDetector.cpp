@@ -11,21 +11,533 @@
 
 #include "CardDetector.h"
 
-mtg::CardDetector::CardDetector() {}
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <opencv2/imgproc/imgproc.hpp>
 
-/*
-void mtg::CardDetector::detectCard(cv::Mat const &_gray, cv::Mat const &_grayBase, std::vector<cv::Point2f> &_corners)
+#include "Log.h"
+#include "OpenCVUtility.h"
+#include "SquareDetection.h"
+
+namespace
+{
+    //! A hull fit is accepted above this share of the perimeter on its four sides, and only
+    //! considered confident as it approaches 1
+    float const kMinSideShare = 0.7f;
+
+    //! findSquares also reports the outline of the region itself, anything this close to it is not a card
+    float const kMaxRegionShare = 0.95f;
+
+    int64_t getMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //! Fits a card to the hull of _edgePoints, returns the share of the hull perimeter its four sides cover, 0 if no card fits
+    float getCardCorners(std::vector<cv::Point2f> const &_edgePoints, std::vector<cv::Point2f> &_corners)
+    {
+        typedef struct Line {
+            cv::Point2f c0;
+            cv::Point2f c1;
+            float length;
+            float angle;
+        } Line;
+
+        _corners.clear();
+
+        // wrap convex hull around contours
+        mtg_debug("convex hull");
+        std::vector<cv::Point2f> hull;
+        cv::convexHull(_edgePoints, hull, true);
+
+        // convert into lines
+        mtg_debug("converting lines");
+        std::vector<Line> lines(hull.size());
+        for (int32_t l = 0; l < (int32_t)hull.size(); l++)
+        {
+            cv::Point2f const p0 = cv::Point2f(hull.at(l).x, hull.at(l).y);
+            cv::Point2f const p1 = cv::Point2f(hull.at((l + 1) % hull.size()).x, hull.at((l + 1) % hull.size()).y);
+
+            Line line;
+            line.c0 = p0;
+            line.c1 = p1;
+            line.length = std::sqrt(std::pow(p1.x - p0.x, 2.f) + std::pow(p1.y - p0.y, 2.f));
+            line.angle  = std::atan2(p1.y - p0.y, p1.x - p0.x);
+            lines.at(l) = line;
+        }
+
+        // straighten out lines
+        mtg_debug("straightening out lines");
+        int32_t lIdx = 0;
+        while (lIdx + 1 < lines.size())
+        {
+            Line l0 = lines.at(lIdx);
+            Line l1 = lines.at((lIdx + 1) % lines.size());
+
+            if (std::fabs(l0.angle - l1.angle) / (CV_PI * 2.f) < 0.0027)
+            {
+                cv::Point2f const &p0 = l0.c0;
+                cv::Point2f const &p1 = l1.c1;
+
+                Line line;
+                line.c0 = p0;
+                line.c1 = p1;
+                line.length = std::sqrt(std::pow(p1.x - p0.x, 2.f) + std::pow(p1.y - p0.y, 2.f));
+                line.angle  = std::atan2(p1.y - p0.y, p1.x - p0.x);
+                lines.at(lIdx) = line;
+                lines.erase(lines.begin() + lIdx + 1);
+            }
+            else
+            {
+                lIdx++;
+            }
+        }
+
+        // sort the lines
+        mtg_debug("sorting lines");
+        std::sort(lines.begin(), lines.end(),
+            [](Line const &lhs, Line const &rhs) {
+                return lhs.length > rhs.length;
+            });
+
+        // compute perimeter
+        mtg_debug("computing perimeter");
+        float perimeter = std::accumulate(lines.begin(), lines.end(), float{},
+            [](float result, Line const &line) {
+                return result + line.length;
+            });
+
+        mtg_debug("Perimeter after detection = " << perimeter);
+
+        if (perimeter > 700 && lines.size() >= 4)
+        {
+            std::vector<Line> firstFourLines;
+            firstFourLines.push_back(lines.at(0));
+            firstFourLines.push_back(lines.at(1));
+            firstFourLines.push_back(lines.at(2));
+            firstFourLines.push_back(lines.at(3));
+
+            float const firstFourSum = std::accumulate(firstFourLines.begin(), firstFourLines.end(), float{},
+                [](float result, const Line &line) {
+                    return result + line.length;
+                });
+
+            if (firstFourSum / perimeter > kMinSideShare)
+            {
+                std::vector<cv::Point2f> corners(4);
+                std::vector<Line> sides = firstFourLines;
+                std::sort(sides.begin(), sides.end(),
+                    [](Line const &lhs, Line const &rhs) {
+                        return lhs.angle > rhs.angle;
+                    });
+
+                for (int32_t i = 0; i < 4; i++)
+                {
+                    // find where the lines intersect to get true corner points for the rectangle
+                    auto intersectLine = [&](Line const &s0, Line const &s1)
+                    {
+                        float const x1 = s0.c0.x, y1 = s0.c0.y;
+                        float const x2 = s0.c1.x, y2 = s0.c1.y;
+                        float const x3 = s1.c0.x, y3 = s1.c0.y;
+                        float const x4 = s1.c1.x, y4 = s1.c1.y;
+                        float const denom = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
+
+                        if (denom == 0)
+                        {
+                            return cv::Point2f(-1, -1);
+                        }
+
+                        float const x = ((x1 * y2 - y1 * x2) * (x3 - x4) - (x1 - x2) * (x3 * y4 - y3 * x4)) / float(denom);
+                        float const y = ((x1 * y2 - y1 * x2) * (y3 - y4) - (y1 - y2) * (x3 * y4 - y3 * x4)) / float(denom);
+
+                        return cv::Point2f(x, y);
+                    };
+
+                    corners.at(i) = intersectLine(sides.at(i), sides.at((i + 1) % 4));
+                }
+
+                std::vector<cv::Point2f>::const_iterator cornersIdx = corners.begin();
+                while (cornersIdx != corners.end())
+                {
+                    if (cornersIdx->x == -1 || cornersIdx->y == -1)
+                    {
+                        mtg_debug("corners were -1, -1");
+                    }
+                    cornersIdx++;
+                }
+
+                mtg::reorderCornerVertices(corners);
+                _corners = corners;
+                return firstFourSum / perimeter;
+            }
+            else
+            {
+                mtg_debug("Made it all the way to the last step, but the perimeter wasn't a sufficient size.");
+            }
+        }
+
+        return 0.f;
+    }
+
+    float getHullConfidence(float _sideShare)
+    {
+        return std::min(1.f, std::max(0.f, (_sideShare - kMinSideShare) / (1.f - kMinSideShare)));
+    }
+
+    //! findSquares only keeps quads whose corners are all within this cosine of a right angle
+    float const kMaxSquareCosine = 0.3f;
+
+    //! Short over long side of a card, 63 x 88 mm
+    float const kCardAspect = 63.f / 88.f;
+
+    //! Relative deviation from kCardAspect at which a square no longer looks like a card at all,
+    //! generous because a card seen at an angle is foreshortened
+    float const kMaxAspectDeviation = 0.35f;
+
+    //! How much a square ordered { TL, BL, BR, TR } looks like a card: the worst corner decides
+    //! how square it is, the mean opposite sides how close it comes to a card's proportions
+    float getSquareConfidence(std::vector<cv::Point2f> const &_corners)
+    {
+        float maxCosine = 0.f;
+        for (int32_t c = 0; c < 4; c++)
+        {
+            cv::Point2f const previous = _corners.at((c + 3) % 4) - _corners.at(c);
+            cv::Point2f const next = _corners.at((c + 1) % 4) - _corners.at(c);
+            float const cosine = std::fabs(previous.dot(next)) / std::sqrt(previous.dot(previous) * next.dot(next) + 1e-10f);
+            maxCosine = std::max(maxCosine, cosine);
+        }
+
+        float const width = 0.5f * float(cv::norm(_corners.at(3) - _corners.at(0)) + cv::norm(_corners.at(2) - _corners.at(1)));
+        float const height = 0.5f * float(cv::norm(_corners.at(1) - _corners.at(0)) + cv::norm(_corners.at(2) - _corners.at(3)));
+        float const aspect = std::min(width, height) / std::max(std::max(width, height), 1.f);
+
+        float const squareness = 1.f - maxCosine / kMaxSquareCosine;
+        float const proportions = 1.f - std::fabs(aspect / kCardAspect - 1.f) / kMaxAspectDeviation;
+        return std::min(1.f, std::max(0.f, std::min(squareness, proportions)));
+    }
+}
+
+mtg::Detector::~Detector()
+{
+}
+
+char const *mtg::HullDetector::getName() const
+{
+    return "hull";
+}
+
+float mtg::HullDetector::detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards)
+{
+    _cards.clear();
+
+    // initial filtering
+    cv::Mat difference, edges;
+    cv::absdiff(_input.gray, _input.grayBase, difference);
+    cv::Canny(difference, edges, 100, 100);
+
+    if (_input.maxCards <= 1)
+    {
+        // one hull around the edges of everything that changed
+        std::vector< std::vector<cv::Point> > contours;
+        cv::findContours(edges, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+        std::vector<cv::Point2f> edgePoints;
+        for (int32_t c = 0; c < (int32_t)contours.size(); c++)
+        {
+            if (contours.at(c).size() > 10)
+            {
+                edgePoints.insert(edgePoints.end(), contours.at(c).begin(), contours.at(c).end());
+            }
+        }
+
+        if (edgePoints.empty())
+        {
+            mtg_debug("edgePoints.size() == 0");
+            return 0.f;
+        }
+
+        std::vector<cv::Point2f> corners;
+        float const sideShare = getCardCorners(edgePoints, corners);
+        if (!corners.empty())
+        {
+            _cards.push_back(corners);
+        }
+
+        return getHullConfidence(sideShare);
+    }
+
+    // close small gaps in every card outline, then each outer component is one card candidate
+    cv::dilate(edges, edges, cv::Mat());
+    std::vector< std::vector<cv::Point> > components;
+    cv::findContours(edges, components, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+    // the least convincing card decides how sure the whole result is
+    float minSideShare = 1.f;
+    std::vector<cv::Point2f> edgePoints, corners;
+    for (int32_t c = 0; c < (int32_t)components.size() && (int32_t)_cards.size() < _input.maxCards; c++)
+    {
+        if (components.at(c).size() <= 10)
+        {
+            continue;
+        }
+
+        edgePoints.assign(components.at(c).begin(), components.at(c).end());
+        float const sideShare = getCardCorners(edgePoints, corners);
+        if (!corners.empty())
+        {
+            _cards.push_back(corners);
+            minSideShare = std::min(minSideShare, sideShare);
+        }
+    }
+
+    mtg_debug("found " << _cards.size() << " cards in " << components.size() << " components");
+    return _cards.empty() ? 0.f : getHullConfidence(minSideShare);
+}
+
+mtg::SquaresDetector::SquaresDetector(int32_t _threshold, int32_t _levels, bool _stopEarly, int32_t _pyramidLevels) :
+    mThreshold(_threshold),
+    mLevels(_levels),
+    mStopEarly(_stopEarly),
+    mPyramidLevels(_pyramidLevels)
+{
+}
+
+char const *mtg::SquaresDetector::getName() const
+{
+    return "squares";
+}
+
+float mtg::SquaresDetector::detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards)
+{
+    _cards.clear();
+
+    // several cards need every pair searched, one of them may hold the only clean outline of a card
+    mtg::SubpixelSquaresVector squares;
+    bool const stopEarly = mStopEarly && _input.maxCards <= 1;
+    if (mPyramidLevels > 0)
+    {
+        mtg::findSquaresCoarseToFine(_input.color, mThreshold, mLevels, mPyramidLevels, squares, stopEarly);
+    }
+    else
+    {
+        mtg::SquaresVector pixelSquares;
+        mtg::findSquaresParallel(_input.color, mThreshold, mLevels, pixelSquares, stopEarly);
+        for (int32_t sq = 0; sq < (int32_t)pixelSquares.size(); sq++)
+        {
+            squares.push_back(mtg::SubpixelSquare(pixelSquares.at(sq).begin(), pixelSquares.at(sq).end()));
+        }
+    }
+
+    // nested outlines remain, the card border around its art box, largest first so the outer edge wins
+    float const maxArea = kMaxRegionShare * _input.color.size().area();
+    std::vector< std::pair<float, int32_t> > byArea;
+    for (int32_t sq = 0; sq < (int32_t)squares.size(); sq++)
+    {
+        float const area = std::fabs(cv::contourArea(cv::Mat(squares.at(sq))));
+        if (area < maxArea)
+        {
+            byArea.push_back(std::make_pair(area, sq));
+        }
+    }
+    std::sort(byArea.rbegin(), byArea.rend());
+
+    for (int32_t s = 0; s < (int32_t)byArea.size() && (int32_t)_cards.size() < _input.maxCards; s++)
+    {
+        std::vector<cv::Point2f> const &corners = squares.at(byArea.at(s).second);
+
+        // a square whose center lies inside a card already taken is a copy or a detail of it
+        cv::Point2f const center = (corners.at(0) + corners.at(1) + corners.at(2) + corners.at(3)) * 0.25f;
+        bool duplicate = false;
+        for (int32_t c = 0; c < (int32_t)_cards.size() && !duplicate; c++)
+        {
+            duplicate = cv::pointPolygonTest(_cards.at(c), center, false) >= 0;
+        }
+
+        if (!duplicate)
+        {
+            // findSquares already orders { TL, BL, BR, TR }
+            _cards.push_back(corners);
+        }
+    }
+
+    // the least convincing card decides how sure the whole result is
+    float confidence = _cards.empty() ? 0.f : 1.f;
+    for (int32_t c = 0; c < (int32_t)_cards.size(); c++)
+    {
+        confidence = std::min(confidence, getSquareConfidence(_cards.at(c)));
+    }
+
+    return confidence;
+}
+
+mtg::CardDetector::CardDetector(float _minConfidence) :
+    mMinConfidence(_minConfidence)
+{
+}
+
+void mtg::CardDetector::addDetector(std::unique_ptr<mtg::Detector> _detector)
+{
+    mtg::DetectorStats stats;
+    stats.name = _detector->getName();
+    stats.numRuns = 0;
+    stats.numHits = 0;
+    stats.numConfident = 0;
+    stats.numChosen = 0;
+    stats.totalMicroseconds = 0;
+
+    mStats.push_back(stats);
+    mDetectors.push_back(std::move(_detector));
+}
+
+float mtg::CardDetector::detect(mtg::DetectorInput const &_input, mtg::CardQuads &_cards)
 {
-    //
+    _cards.clear();
+
+    float bestConfidence = 0.f;
+    int32_t best = -1;
+    mtg::CardQuads cards;
+    for (int32_t d = 0; d < (int32_t)mDetectors.size(); d++)
+    {
+        mtg::DetectorStats &stats = mStats.at(d);
+
+        int64_t const start = getMicroseconds();
+        float const confidence = mDetectors.at(d)->detect(_input, cards);
+        stats.totalMicroseconds += getMicroseconds() - start;
+        stats.numRuns++;
+
+        if (cards.empty())
+        {
+            continue;
+        }
+
+        stats.numHits++;
+        if (best < 0 || confidence > bestConfidence)
+        {
+            best = d;
+            bestConfidence = confidence;
+            _cards.swap(cards);
+        }
+
+        if (confidence >= mMinConfidence)
+        {
+            stats.numConfident++;
+            break;
+        }
+    }
+
+    if (best >= 0)
+    {
+        mStats.at(best).numChosen++;
+        mtg_debug(mStats.at(best).name << " detector found " << _cards.size() << " cards, confidence " << bestConfidence);
+    }
+
+    return bestConfidence;
 }
 
-void mtg::CardDetector::getRectifiedCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners)
+std::vector<mtg::DetectorStats> const &mtg::CardDetector::getStats() const
 {
-    //
+    return mStats;
 }
 
-void mtg::CardDetector::reorderCornerVertices(std::vector<cv::Point2f> &corners)
+void mtg::rectifyCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners, cv::Mat &_card)
 {
-    //
+    // order is guaranteed from mtg::reorderSquareVertices
+    cv::Point2f topLeft     = _corners.at(0);
+    cv::Point2f bottomLeft  = _corners.at(1);
+    cv::Point2f bottomRight = _corners.at(2);
+    cv::Point2f topRight    = _corners.at(3);
+
+    // gather target width and height based on rect dimensions
+    float const width0  = (float)cv::norm(bottomRight - bottomLeft);
+    float const width1  = (float)cv::norm(topRight - topLeft);
+    float const height0 = (float)cv::norm(topRight - bottomRight);
+    float const height1 = (float)cv::norm(topLeft - bottomLeft);
+
+    // NOTE: why is this transposed?
+    int32_t const maxWidth = std::round(std::max(height0, height1));
+    int32_t const maxHeight = std::round(std::max(width0, width1));
+
+    std::vector<cv::Point2f> sourceRect;
+    sourceRect.push_back(topLeft);
+    sourceRect.push_back(bottomLeft);
+    sourceRect.push_back(bottomRight);
+    sourceRect.push_back(topRight);
+
+    std::vector<cv::Point2f> destRect;
+    destRect.push_back(cv::Point2f(0, 0));
+    destRect.push_back(cv::Point2f(0, maxHeight));
+    destRect.push_back(cv::Point2f(maxWidth, maxHeight));
+    destRect.push_back(cv::Point2f(maxWidth, 0));
+
+    // probably not needed, but here to be extra safe
+    // ----------------------------------------------
+    mtg::reorderCornerVertices(destRect);
+    // ----------------------------------------------
+
+    // allocate output image and perform perspective warp to rectify square image
+    cv::Mat warped(cv::Size(maxWidth, maxHeight), _inputColor.type());
+    cv::Mat perspective = cv::getPerspectiveTransform(cv::Mat(sourceRect), cv::Mat(destRect));
+    cv::warpPerspective(_inputColor, warped, perspective, cv::Size(maxWidth, maxHeight));
+    cv::resize(warped, _card, cv::Size(222, 311));
+    mtg::flipImage(_card, _card);
+}
+
+void mtg::reorderCornerVertices(std::vector<cv::Point2f> &_corners)
+{
+    // to simulate in-place modification
+    std::vector<cv::Point2f> rect = _corners;
+
+    // topLeft will always have the smallest sum
+    // bottomLeft will always have the largest difference
+    // bottomRight will always have the largest sum
+    // topRight will always have the smallest difference
+
+    int32_t smallSum  = +INT_MAX / 2, smallSumIndex  = -1;
+    int32_t largeSum  = -INT_MAX / 2, largeSumIndex  = -1;
+    int32_t smallDiff = +INT_MAX / 2, smallDiffIndex = -1;
+    int32_t largeDiff = -INT_MAX / 2, largeDiffIndex = -1;
+    for (int32_t pt = 0; pt < (int32_t)rect.size(); pt++)
+    {
+        int32_t const sum  = rect.at(pt).x + rect.at(pt).y;
+        int32_t const diff = rect.at(pt).x - rect.at(pt).y;
+        if (sum < smallSum)
+        {
+            smallSum = sum;
+            smallSumIndex = pt;
+        }
+
+        if (sum > largeSum)
+        {
+            largeSum = sum;
+            largeSumIndex = pt;
+        }
+
+        if (diff < smallDiff)
+        {
+            smallDiff = diff;
+            smallDiffIndex = pt;
+        }
+
+        if (diff > largeDiff)
+        {
+            largeDiff = diff;
+            largeDiffIndex = pt;
+        }
+    }
+
+    cv::Point2f topLeft     = rect.at(smallSumIndex);
+    cv::Point2f bottomLeft  = rect.at(largeDiffIndex);
+    cv::Point2f bottomRight = rect.at(largeSumIndex);
+    cv::Point2f topRight    = rect.at(smallDiffIndex);
+
+    // ensure the corners will always hold the vertices in this order
+    _corners.clear();
+    _corners.push_back(topLeft);
+    _corners.push_back(bottomLeft);
+    _corners.push_back(bottomRight);
+    _corners.push_back(topRight);
 }
-*/
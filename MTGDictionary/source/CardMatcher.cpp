@@ -11,13 +11,94 @@
 
 #include "CardMatcher.h"
 
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+#include "CatalogFile.h"
 #include "Log.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    //! Number of distances computed per call into the scan kernel, sized to stay in L1
+    size_t const kScanBlockSize = 1024;
+
+    //! Catalog slices scanned by a batch per pool thread, a little more than one keeps the threads balanced
+    uint32_t const kBatchSlicesPerThread = 2;
+
+    //! Thresholds the lowest _side x _side DCT coefficients of the card art in a single channel image against their mean
+    void getChannelDCTBits(cv::Mat const &_channel, int32_t _side, cv::Mat &_bits)
+    {
+        int32_t const dctSide = _side * 4;
+
+        cv::Mat sourceFloat;
+        _channel.convertTo(sourceFloat, CV_32F, 1.f / 255.f);
+        sourceFloat = cv::Mat(sourceFloat, cv::Rect(16, 31, 194, 144));
+
+        cv::Mat cardArt(sourceFloat.size(), CV_32F);
+        cv::resize(sourceFloat, cardArt, cv::Size(dctSide, dctSide));
+
+        cv::Mat dct(cv::Size(dctSide, dctSide), CV_32F);
+        cv::dct(cardArt, dct);
+        dct = cv::Mat(dct, cv::Rect(1, 1, _side, _side));
+
+        cv::Scalar avg = cv::mean(dct)[0];
+        cv::Mat avg8Bit(dct.size(), CV_8UC1);
+        cv::compare(dct, avg, avg8Bit, cv::CMP_GT);
+
+        _bits = (avg8Bit == 255);
+    }
+
+    void getImageDCTBits(cv::Mat const &_source, int32_t _side, cv::Mat &_bits)
+    {
+        cv::Mat gray;
+        cv::cvtColor(_source, gray, CV_BGR2GRAY);
+        getChannelDCTBits(gray, _side, _bits);
+    }
+
+    //! Orders re-ranked candidates by their refined distance, then as in the coarse stage
+    inline bool refinedLess(mtg::CandidateMatch const &_lhs, mtg::CandidateMatch const &_rhs)
+    {
+        return _lhs.refinedDistance < _rhs.refinedDistance || (_lhs.refinedDistance == _rhs.refinedDistance && _lhs < _rhs);
+    }
+
+    inline double getMillisecondsSince(std::chrono::high_resolution_clock::time_point const &_start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _start).count();
+    }
+}
 
-void mtg::loadAllSets(QString const &_directory, std::vector<mtg::Card> &_cards)
+void mtg::loadAllSets(QString const &_directory, mtg::CardCatalog &_catalog, bool _useCatalogFile, mtg::LoadProgressCallback const &_progress)
 {
-    _cards.clear();
+    _catalog.cards.clear();
+    _catalog.hashes.clear();
+    _catalog.colorHashes.clear();
+    _catalog.index.clear();
+
+    // hashes from the last run, keyed by file name, reused while the image is unchanged
+    QString const catalogPath = QDir(_directory).filePath(kCatalogFileName);
+    mtg::CatalogFile previous;
+    std::vector<mtg::Card> previousCards;
+    std::unordered_map<std::string, int32_t> previousIndex;
+    if (_useCatalogFile && previous.open(catalogPath))
+    {
+        previousCards.resize(previous.size());
+        for (int32_t c = 0; c < (int32_t)previous.size(); c++)
+        {
+            previous.getCard(c, previousCards.at(c));
+            previousIndex[previousCards.at(c).fileName] = c;
+        }
+    }
 
-    QDirIterator setFolders(_directory, QDir::AllEntries | QDir::NoDotAndDotDot);
+    // enumeration stage, serial: walking the folders fixes the catalog order, and
+    // only the images that are new or changed since the catalog file was written
+    // are queued for decoding and hashing. Images that failed to decode then are
+    // only tried again once they change.
+    std::vector<uint32_t> stale;
+    std::vector<mtg::Card> unreadableCards;
+    QDirIterator setFolders(_directory, QDir::Dirs | QDir::NoDotAndDotDot);
     while (setFolders.hasNext())
     {
         QDirIterator images(setFolders.next(), QStringList() << "*.png");
@@ -28,33 +109,141 @@ void mtg::loadAllSets(QString const &_directory, std::vector<mtg::Card> &_cards)
             mtg::Card card;
             card.fileName = images.filePath().toStdString();
             card.setName  = setFolders.fileInfo().baseName().toStdString();
-            card.image = cv::imread(card.fileName.c_str());
-            getImageDCTHash(card.image, card.dctHash);
+            card.modifiedTime = images.fileInfo().lastModified().toMSecsSinceEpoch();
+            card.fileSize = images.fileInfo().size();
+
+            mtg::CardHash hash;
+            mtg::ColorHash colorHash;
+            std::unordered_map<std::string, int32_t>::const_iterator cached = previousIndex.find(card.fileName);
+            if (cached != previousIndex.end() &&
+                previousCards.at(cached->second).modifiedTime == card.modifiedTime &&
+                previousCards.at(cached->second).fileSize == card.fileSize)
+            {
+                if (previous.isUnreadable(cached->second))
+                {
+                    unreadableCards.push_back(card);
+                    continue;
+                }
+
+                hash = previous.getHash(cached->second);
+                colorHash = previous.getColorHash(cached->second);
+            }
+            else
+            {
+                stale.push_back(_catalog.cards.size());
+            }
+
+            _catalog.cards.push_back(card);
+            _catalog.hashes.push_back(hash);
+            _catalog.colorHashes.push_back(colorHash);
+        }
+    }
+
+    // decode and hash stages, on every core: each image writes its own catalog slot,
+    // so the result is the same as hashing them one after the other
+    uint32_t const numStale = stale.size();
+    std::vector<uint8_t> unreadable(numStale, 0);
+    std::mutex progressMutex;
+    uint32_t numDone = 0;
+    mtg::ThreadPool::getGlobalPool().parallelFor(numStale, [&](uint32_t _s) {
+        uint32_t const c = stale.at(_s);
+
+        cv::Mat const image = cv::imread(_catalog.cards.at(c).fileName.c_str());
+        if (image.empty())
+        {
+            unreadable.at(_s) = 1;
+        }
+        else
+        {
+            getImageDCTHash(image, _catalog.hashes.at(c));
+            getImageColorHash(image, _catalog.colorHashes.at(c));
+        }
 
-            _cards.push_back(card);
+        std::lock_guard<std::mutex> lock(progressMutex);
+        numDone++;
+        if (_progress)
+        {
+            _progress(numDone, numStale);
+        }
+    });
+
+    // images that could not be decoded are left out, the same way on every run
+    uint32_t numKept = 0;
+    uint32_t nextStale = 0;
+    for (uint32_t c = 0; c < (uint32_t)_catalog.cards.size(); c++)
+    {
+        if (nextStale < numStale && stale.at(nextStale) == c)
+        {
+            if (unreadable.at(nextStale++))
+            {
+                mtg_warn("Unable to read card image " << _catalog.cards.at(c).fileName << ", skipping it until it changes.");
+                unreadableCards.push_back(_catalog.cards.at(c));
+                continue;
+            }
         }
+
+        _catalog.cards.at(numKept) = _catalog.cards.at(c);
+        _catalog.hashes.at(numKept) = _catalog.hashes.at(c);
+        _catalog.colorHashes.at(numKept) = _catalog.colorHashes.at(c);
+        numKept++;
+    }
+    _catalog.cards.resize(numKept);
+    _catalog.hashes.resize(numKept);
+    _catalog.colorHashes.resize(numKept);
+
+    mtg_info("Loaded " << _catalog.cards.size() << " cards, " << numStale << " images had to be hashed, "
+             << unreadableCards.size() << " could not be read.");
+
+    // only touch the file on disk when something was added, changed or removed
+    if (_useCatalogFile && (numStale > 0 || previousCards.size() != _catalog.cards.size() + unreadableCards.size()))
+    {
+        // done with the old records, release the mapping before the file is replaced
+        previous.close();
+        mtg::writeCatalogFile(catalogPath, _catalog, unreadableCards);
+    }
+
+    if (_catalog.hashes.size() >= kHammingIndexMinCards)
+    {
+        _catalog.index.build(_catalog.hashes);
     }
 }
 
 void mtg::getImageDCTHash(cv::Mat const &_source, cv::Mat &_hash)
 {
-    cv::Mat sourceFloat;
-    cv::cvtColor(_source, sourceFloat, CV_BGR2GRAY);
-    sourceFloat.convertTo(sourceFloat, CV_32F, 1.f / 255.f);
-    sourceFloat = cv::Mat(sourceFloat, cv::Rect(16, 31, 194, 144));
+    getImageDCTBits(_source, 8, _hash);
+}
 
-    cv::Mat cardArt(sourceFloat.size(), CV_32F);
-    cv::resize(sourceFloat, cardArt, cv::Size(32, 32));
+template <uint32_t Bits>
+void mtg::getImageDCTHash(cv::Mat const &_source, mtg::PackedHash<Bits> &_hash)
+{
+    // 64, 256 and 1024 bits map onto square 8x8, 16x16 and 32x32 coefficient blocks
+    static_assert(Bits == 64 || Bits == 256 || Bits == 1024, "DCT hash width must be 64, 256 or 1024 bits");
+    int32_t const side = (Bits == 64) ? 8 : (Bits == 256) ? 16 : 32;
 
-    cv::Mat dct(cv::Size(32, 32), CV_32F);
-    cv::dct(cardArt, dct);
-    dct = cv::Mat(dct, cv::Rect(1, 1, 8, 8));
+    cv::Mat bits;
+    getImageDCTBits(_source, side, bits);
+    mtg::packHash(bits, _hash);
+}
+
+template void mtg::getImageDCTHash<64>(cv::Mat const &, mtg::PackedHash<64> &);
+template void mtg::getImageDCTHash<256>(cv::Mat const &, mtg::PackedHash<256> &);
+template void mtg::getImageDCTHash<1024>(cv::Mat const &, mtg::PackedHash<1024> &);
+
+void mtg::getImageColorHash(cv::Mat const &_source, mtg::ColorHash &_hash)
+{
+    std::vector<cv::Mat> channels;
+    cv::split(_source, channels);
 
-    cv::Scalar avg = cv::mean(dct)[0];
-    cv::Mat avg8Bit(dct.size(), CV_8UC1);
-    cv::compare(dct, avg, avg8Bit, cv::CMP_GT);
+    // stack the three 16x16 blocks so each channel fills its own 256 bits of the hash
+    std::vector<cv::Mat> channelBits(channels.size());
+    for (int32_t c = 0; c < (int32_t)channels.size(); c++)
+    {
+        getChannelDCTBits(channels.at(c), 16, channelBits.at(c));
+    }
 
-    _hash = (avg8Bit == 255);
+    cv::Mat bits;
+    cv::vconcat(channelBits, bits);
+    mtg::packHash(bits, _hash);
 }
 
 float mtg::getHammingDistance(cv::Mat const &_image0, cv::Mat const &_image1)
@@ -73,24 +262,255 @@ float mtg::getHammingDistance(cv::Mat const &_image0, cv::Mat const &_image1)
     return sum;
 }
 
-void mtg::getCandidateMatches(cv::Mat const &_cardImage, std::vector<mtg::Card> const &_cache, std::vector<mtg::Card> &_candidates)
+void mtg::getCandidateMatches(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _k, std::vector<mtg::CandidateMatch> &_candidates)
+{
+    mtg::CardHash phash;
+    getImageDCTHash(_cardImage, phash);
+
+    getCandidateMatches(phash, _catalog, _k, _candidates);
+}
+
+void mtg::getCandidateMatches(mtg::CardHash const &_hash, mtg::CardCatalog const &_catalog, uint32_t _k, std::vector<mtg::CandidateMatch> &_candidates)
 {
+    if (!_catalog.index.empty())
+    {
+        _catalog.index.nearestSearch(_catalog.hashes, _hash, _k, _candidates);
+        return;
+    }
+
     _candidates.clear();
+    _candidates.reserve(_k);
+
+    if (_k == 0)
+    {
+        return;
+    }
+
+    // distances are produced a block at a time into stack storage, and the best
+    // _k kept in a max-heap inside _candidates, so a reused vector never allocates
+    uint32_t distances[kScanBlockSize];
+    size_t const numHashes = _catalog.hashes.size();
+    for (size_t begin = 0; begin < numHashes; begin += kScanBlockSize)
+    {
+        size_t const count = std::min(kScanBlockSize, numHashes - begin);
+        mtg::scanHammingDistances(_hash, _catalog.hashes.data() + begin, count, distances);
+
+        for (size_t h = 0; h < count; h++)
+        {
+            mtg::CandidateMatch const candidate = { (uint32_t)(begin + h), distances[h], 0 };
+            mtg::pushCandidate(_candidates, _k, candidate);
+        }
+    }
 
-    cv::Mat phash;
+    std::sort_heap(_candidates.begin(), _candidates.end());
+}
+
+void mtg::getCandidateMatchesBatch(std::vector<cv::Mat> const &_cardImages, mtg::CardCatalog const &_catalog, uint32_t _k,
+                                   std::vector< std::vector<mtg::CandidateMatch> > &_candidates, mtg::BatchStats *_stats)
+{
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+
+    std::vector<mtg::CardHash> hashes(_cardImages.size());
+    mtg::ThreadPool::getGlobalPool().parallelFor(hashes.size(), [&](uint32_t _q) {
+        getImageDCTHash(_cardImages.at(_q), hashes.at(_q));
+    });
+
+    double const hashTime = getMillisecondsSince(start);
+
+    getCandidateMatchesBatch(hashes, _catalog, _k, _candidates, _stats);
+
+    if (_stats != NULL)
+    {
+        _stats->hashMilliseconds = hashTime;
+        _stats->queriesPerSecond = _stats->numQueries / (getMillisecondsSince(start) / 1000.0);
+    }
+}
+
+void mtg::getCandidateMatchesBatch(std::vector<mtg::CardHash> const &_hashes, mtg::CardCatalog const &_catalog, uint32_t _k,
+                                   std::vector< std::vector<mtg::CandidateMatch> > &_candidates, mtg::BatchStats *_stats)
+{
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+
+    uint32_t const numQueries = _hashes.size();
+    _candidates.resize(numQueries);
+
+    if (!_catalog.index.empty())
+    {
+        // the index touches only a few buckets per query, there is no shared scan to block
+        mtg::ThreadPool::getGlobalPool().parallelFor(numQueries, [&](uint32_t _q) {
+            _catalog.index.nearestSearch(_catalog.hashes, _hashes.at(_q), _k, _candidates.at(_q));
+        });
+    }
+    else
+    {
+        // the catalog is cut into slices instead of the batch into query tiles, so a batch
+        // of any size uses every thread and each hash is still loaded only once per batch
+        size_t const numHashes = _catalog.hashes.size();
+        size_t const numBlocks = (numHashes + kScanBlockSize - 1) / kScanBlockSize;
+        uint32_t const numSlices = std::max<size_t>(1, std::min<size_t>(numBlocks, mtg::ThreadPool::getGlobalPool().getNumThreads() * kBatchSlicesPerThread));
+        size_t const blocksPerSlice = (numBlocks + numSlices - 1) / numSlices;
+
+        // heaps of the best _k per slice and query, in slice-major order
+        std::vector< std::vector<mtg::CandidateMatch> > sliceCandidates(numSlices * numQueries);
+        if (_k > 0)
+        {
+            mtg::ThreadPool::getGlobalPool().parallelFor(numSlices, [&](uint32_t _slice) {
+                size_t const firstHash = std::min(numHashes, _slice * blocksPerSlice * kScanBlockSize);
+                size_t const lastHash = std::min(numHashes, firstHash + blocksPerSlice * kScanBlockSize);
+                std::vector<mtg::CandidateMatch> *heaps = sliceCandidates.data() + _slice * numQueries;
+
+                // each catalog block is loaded once and then compared against every query while hot
+                uint32_t distances[kScanBlockSize];
+                for (size_t begin = firstHash; begin < lastHash; begin += kScanBlockSize)
+                {
+                    size_t const count = std::min(kScanBlockSize, lastHash - begin);
+                    for (uint32_t q = 0; q < numQueries; q++)
+                    {
+                        mtg::scanHammingDistances(_hashes.at(q), _catalog.hashes.data() + begin, count, distances);
+
+                        std::vector<mtg::CandidateMatch> &heap = heaps[q];
+                        for (size_t h = 0; h < count; h++)
+                        {
+                            mtg::CandidateMatch const candidate = { (uint32_t)(begin + h), distances[h], 0 };
+                            mtg::pushCandidate(heap, _k, candidate);
+                        }
+                    }
+                }
+            });
+        }
+
+        // candidates order by distance then index, so merging the slices gives exactly the single scan result
+        mtg::ThreadPool::getGlobalPool().parallelFor(numQueries, [&](uint32_t _q) {
+            std::vector<mtg::CandidateMatch> &candidates = _candidates.at(_q);
+            candidates.clear();
+            for (uint32_t slice = 0; slice < numSlices; slice++)
+            {
+                std::vector<mtg::CandidateMatch> const &heap = sliceCandidates.at(slice * numQueries + _q);
+                candidates.insert(candidates.end(), heap.begin(), heap.end());
+            }
+
+            size_t const numKept = std::min<size_t>(_k, candidates.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + numKept, candidates.end());
+            candidates.resize(numKept);
+        });
+    }
+
+    if (_stats != NULL)
+    {
+        double const matchTime = getMillisecondsSince(start);
+
+        _stats->numQueries = numQueries;
+        _stats->hashMilliseconds = 0.0;
+        _stats->matchMilliseconds = matchTime;
+        _stats->queriesPerSecond = numQueries / (matchTime / 1000.0);
+    }
+}
+
+void mtg::rerankCandidates(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, std::vector<mtg::CandidateMatch> &_candidates, mtg::RerankStats *_stats)
+{
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+
+    mtg::ColorHash colorHash;
+    getImageColorHash(_cardImage, colorHash);
+    double const descriptorTime = getMillisecondsSince(start);
+
+    rerankCandidates(colorHash, _catalog, _candidates, _stats);
+
+    if (_stats != NULL)
+    {
+        _stats->descriptorMilliseconds = descriptorTime;
+        _stats->rerankMilliseconds = getMillisecondsSince(start);
+    }
+}
+
+void mtg::rerankCandidates(mtg::ColorHash const &_colorHash, mtg::CardCatalog const &_catalog, std::vector<mtg::CandidateMatch> &_candidates, mtg::RerankStats *_stats)
+{
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+
+    if (_candidates.size() > kMaxRerankCandidates)
+    {
+        _candidates.resize(kMaxRerankCandidates);
+    }
+
+    // the color distance decides, the pHash distance still counts so near ties fall back on it
+    for (int32_t c = 0; c < (int32_t)_candidates.size(); c++)
+    {
+        mtg::CandidateMatch &candidate = _candidates.at(c);
+        candidate.refinedDistance = mtg::getHammingDistance(_colorHash, _catalog.colorHashes.at(candidate.index)) + candidate.distance;
+    }
+
+    std::sort(_candidates.begin(), _candidates.end(), refinedLess);
+
+    if (_stats != NULL)
+    {
+        _stats->numReranked = _candidates.size();
+        _stats->descriptorMilliseconds = 0.0;
+        _stats->rerankMilliseconds = getMillisecondsSince(start);
+    }
+}
+
+void mtg::getRankedMatches(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _coarseK, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches, mtg::RerankStats *_stats)
+{
+    // only kMaxRerankCandidates can be re-ranked, so no more than that are ever returned
+    uint32_t const k = std::min(_k, kMaxRerankCandidates);
+
+    getCandidateMatches(_cardImage, _catalog, std::max(std::min(_coarseK, kMaxRerankCandidates), k), _matches);
+    rerankCandidates(_cardImage, _catalog, _matches, _stats);
+
+    if (_matches.size() > k)
+    {
+        _matches.resize(k);
+    }
+}
+
+void mtg::getRankedMatches(mtg::CardHash const &_hash, mtg::ColorHash const &_colorHash, mtg::CardCatalog const &_catalog, uint32_t _coarseK, uint32_t _k,
+                           std::vector<mtg::CandidateMatch> &_matches, mtg::RerankStats *_stats)
+{
+    uint32_t const k = std::min(_k, kMaxRerankCandidates);
+
+    getCandidateMatches(_hash, _catalog, std::max(std::min(_coarseK, kMaxRerankCandidates), k), _matches);
+    rerankCandidates(_colorHash, _catalog, _matches, _stats);
+
+    if (_matches.size() > k)
+    {
+        _matches.resize(k);
+    }
+}
+
+void mtg::getCandidateMatchesWithin(cv::Mat const &_cardImage, mtg::CardCatalog const &_catalog, uint32_t _radius, std::vector<mtg::CandidateMatch> &_candidates)
+{
+    mtg::CardHash phash;
     getImageDCTHash(_cardImage, phash);
 
-    std::map<float, mtg::Card> sortedDistances;
-    for (auto const &card : _cache)
+    getCandidateMatchesWithin(phash, _catalog, _radius, _candidates);
+}
+
+void mtg::getCandidateMatchesWithin(mtg::CardHash const &_hash, mtg::CardCatalog const &_catalog, uint32_t _radius, std::vector<mtg::CandidateMatch> &_candidates)
+{
+    if (!_catalog.index.empty())
     {
-        float const dist = getHammingDistance(card.dctHash, phash);
-        sortedDistances[dist] = card;
+        _catalog.index.radiusSearch(_catalog.hashes, _hash, _radius, _candidates);
+        return;
     }
 
-    std::map<float, mtg::Card>::const_iterator idx = sortedDistances.begin();
-    while (idx != sortedDistances.end() || _candidates.size() == 20)
+    _candidates.clear();
+
+    uint32_t distances[kScanBlockSize];
+    size_t const numHashes = _catalog.hashes.size();
+    for (size_t begin = 0; begin < numHashes; begin += kScanBlockSize)
     {
-        _candidates.push_back(idx->second);
-        idx++;
+        size_t const count = std::min(kScanBlockSize, numHashes - begin);
+        mtg::scanHammingDistances(_hash, _catalog.hashes.data() + begin, count, distances);
+
+        for (size_t h = 0; h < count; h++)
+        {
+            if (distances[h] <= _radius)
+            {
+                mtg::CandidateMatch const candidate = { (uint32_t)(begin + h), distances[h], 0 };
+                _candidates.push_back(candidate);
+            }
+        }
     }
+
+    std::sort(_candidates.begin(), _candidates.end());
 }
@@ -0,0 +1,130 @@
+//! ----------------------------------------------------------------------------
+//! CardRecognizer.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "CardRecognizer.h"
+
+#include "ThreadPool.h"
+
+mtg::CardRecognizer::CardRecognizer(mtg::CardCatalog const &_catalog, uint32_t _coarseK, uint32_t _k) :
+    mCatalog(_catalog),
+    mCoarseK(_coarseK),
+    mK(_k),
+    mCardId(0),
+    mNumRecognized(0),
+    mNumDecisionFrames(0)
+{
+}
+
+void mtg::CardRecognizer::addSnapshots(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, std::vector<mtg::Recognition> &_recognized)
+{
+    addMatches(_frame, _cardId, _cards, [&](uint32_t _slot, std::vector<mtg::CandidateMatch> &_candidates) {
+        mtg::getRankedMatches(_cards.at(_slot), mCatalog, mCoarseK, mK, _candidates);
+    }, _recognized);
+}
+
+void mtg::CardRecognizer::addSnapshots(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, std::vector<mtg::CardHash> const &_hashes,
+                                       std::vector<mtg::ColorHash> const &_colorHashes, std::vector<mtg::Recognition> &_recognized)
+{
+    addMatches(_frame, _cardId, _cards, [&](uint32_t _slot, std::vector<mtg::CandidateMatch> &_candidates) {
+        mtg::getRankedMatches(_hashes.at(_slot), _colorHashes.at(_slot), mCatalog, mCoarseK, mK, _candidates);
+    }, _recognized);
+}
+
+void mtg::CardRecognizer::hashSnapshots(std::vector<cv::Mat> const &_cards, std::vector<mtg::CardHash> &_hashes, std::vector<mtg::ColorHash> &_colorHashes)
+{
+    _hashes.resize(_cards.size());
+    _colorHashes.resize(_cards.size());
+    mtg::ThreadPool::getGlobalPool().parallelFor(_cards.size(), [&](uint32_t _c) {
+        mtg::getImageDCTHash(_cards.at(_c), _hashes.at(_c));
+        mtg::getImageColorHash(_cards.at(_c), _colorHashes.at(_c));
+    });
+}
+
+void mtg::CardRecognizer::addMatches(uint64_t _frame, uint64_t _cardId, std::vector<cv::Mat> const &_cards, SlotMatcher const &_match, std::vector<mtg::Recognition> &_recognized)
+{
+    if (_cards.empty())
+    {
+        return;
+    }
+
+    if (_cardId != mCardId || mEvidence.size() != _cards.size())
+    {
+        mCardId = _cardId;
+        mEvidence.assign(_cards.size(), mtg::EvidenceAccumulator());
+    }
+
+    // only the slots still gathering evidence are matched
+    std::vector<uint32_t> openSlots;
+    for (uint32_t s = 0; s < (uint32_t)mEvidence.size(); s++)
+    {
+        if (!mEvidence.at(s).isDecided())
+        {
+            openSlots.push_back(s);
+        }
+    }
+
+    std::vector<mtg::Recognition> recognitions(openSlots.size());
+    std::vector<uint8_t> decided(openSlots.size(), 0);
+    mtg::ThreadPool::getGlobalPool().parallelFor(openSlots.size(), [&](uint32_t _o) {
+        uint32_t const slot = openSlots.at(_o);
+        mtg::Recognition &recognition = recognitions.at(_o);
+        _match(slot, recognition.candidates);
+
+        // every slot has its own accumulator, so the slots never share state
+        if (mEvidence.at(slot).addCandidates(recognition.candidates))
+        {
+            recognition.frame = _frame;
+            recognition.cardId = _cardId;
+            recognition.slot = slot;
+            recognition.decision = mEvidence.at(slot).getDecision();
+            recognition.snapshot = _cards.at(slot);
+            decided.at(_o) = 1;
+        }
+    });
+
+    for (int32_t o = 0; o < (int32_t)recognitions.size(); o++)
+    {
+        if (decided.at(o))
+        {
+            _recognized.push_back(recognitions.at(o));
+            mNumRecognized++;
+            mNumDecisionFrames += recognitions.at(o).decision.numFrames;
+        }
+    }
+}
+
+bool mtg::CardRecognizer::needsSnapshots(uint64_t _cardId) const
+{
+    if (_cardId != mCardId || mEvidence.empty())
+    {
+        return true;
+    }
+
+    for (int32_t s = 0; s < (int32_t)mEvidence.size(); s++)
+    {
+        if (!mEvidence.at(s).isDecided())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t mtg::CardRecognizer::getNumRecognized() const
+{
+    return mNumRecognized;
+}
+
+double mtg::CardRecognizer::getFramesPerDecision() const
+{
+    return mNumRecognized > 0 ? double(mNumDecisionFrames) / mNumRecognized : 0.0;
+}
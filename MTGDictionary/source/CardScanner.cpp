@@ -11,414 +11,575 @@
 
 #include "CardScanner.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
 #include "Log.h"
-#include "OpenCVUtility.h"
+#include "ThreadPool.h"
 
-mtg::CardScanner::CardScanner(cv::VideoCapture *_camera) :
-    mCamera(_camera),
-    mRecentFramesMax(3),
-    mNumPixels(-1),
-    mHasMoved(false),
-    mFound(false)
+namespace
 {
+    int32_t const kMaxRecentFrames = 8;
+    //! Weight of the newest frame in the average motion is measured against, halving the weight of
+    //! every older frame so the last two or three dominate, as the frame history used to
+    float const kMotionAverageRate = 0.5f;
+    int32_t const kMotionPixelThreshold = 30;
+    float const kMotionRegionPadding = 0.1f;
+    float const kMaxTrackingError = 30.f;
+    //! Largest factor the area of a tracked card may grow or shrink by from one frame to the next
+    float const kMaxTrackedAreaChange = 1.25f;
+
+    //! A re-detected card is the tracked one if no corner moved further than this share of its side
+    float const kMaxReverifiedCornerShift = 0.1f;
+
+    //! Whether _corners outline the same card as _previous, both ordered { TL, BL, BR, TR }
+    bool isSameCard(std::vector<cv::Point2f> const &_corners, std::vector<cv::Point2f> const &_previous)
+    {
+        if (_corners.size() != _previous.size())
+        {
+            return false;
+        }
+
+        float const maxShift = kMaxReverifiedCornerShift * std::sqrt(std::fabs(cv::contourArea(_previous)));
+        for (int32_t c = 0; c < (int32_t)_corners.size(); c++)
+        {
+            if (cv::norm(_corners.at(c) - _previous.at(c)) > maxShift)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //! Mean squared difference between _frame and the running average of the frames before it,
+    //! blending _frame into the average with weight _rate in the same single pass
+    float updateMotionAverage(cv::Mat const &_frame, float _rate, cv::Mat &_average)
+    {
+        if (_average.size() != _frame.size())
+        {
+            _frame.convertTo(_average, CV_32F);
+            return 0.f;
+        }
+
+        double sum = 0.0;
+        for (int32_t j = 0; j < _frame.rows; j++)
+        {
+            uint8_t const *row = _frame.ptr<uint8_t>(j);
+            float *average = _average.ptr<float>(j);
+            float rowSum = 0.f;
+            for (int32_t i = 0; i < _frame.cols; i++)
+            {
+                float const d = float(row[i]) - average[i];
+                rowSum += d * d;
+                average[i] += _rate * d;
+            }
+            sum += rowSum;
+        }
+
+        return float(sum / double(_frame.total()));
+    }
 }
 
-bool mtg::CardScanner::checkForCard(cv::Mat &_detectedCard)
+mtg::ScannerOptions::ScannerOptions() :
+    threadedCapture(false),
+    lowResolutionMotion(false),
+    motionWidth(160),
+    adaptiveBackground(false),
+    backgroundLearningRate(0.02f),
+    backgroundFullUpdateInterval(15),
+    backgroundSimilarityThreshold(0.75f),
+    cropToMotion(false),
+    trackCards(false),
+    maxTrackedFrames(30),
+    maxCards(1),
+    squaresFallback(false),
+    minDetectionConfidence(0.5f),
+    squaresPyramidLevels(0)
 {
-    mFound = false;
+}
 
-    grabFrame();
-    updateBackground();
-    checkForMovement();
+mtg::CardScanner::CardScanner(mtg::FrameSource *_source, mtg::ScannerOptions const &_options) :
+    mOptions(_options),
+    mSource(_source),
+    mRecentFramesMax(3),
+    mFramePool(mRecentFramesMax + 1),
+    mDetector(_options.minDetectionConfidence),
+    mTrackedArea(0.f),
+    mTrackedFrames(0),
+    mCardId(0),
+    mTracking(false),
+    mStaticFrames(0),
+    mFrameTimestamp(0),
+    mHasMoved(false),
+    mFinished(false)
+{
+    // the full resolution blend runs every backgroundFullUpdateInterval static frames
+    mOptions.backgroundFullUpdateInterval = std::max(1, mOptions.backgroundFullUpdateInterval);
 
-    if (mFound)
+    if (mOptions.threadedCapture)
     {
-        _detectedCard = mSnapshot.clone();
+        mCapture.reset(new mtg::CaptureThread(mSource));
+        mCapture->start();
     }
 
-    cv::Mat smallerCameraFeedFrame;
-    cv::resize(mLastFrame, smallerCameraFeedFrame, cv::Size(640, 480));
-    cv::imshow("Camera Feed", smallerCameraFeedFrame);
+    // cheapest first, the cascade only pays for findSquares when the hull is unsure
+    mDetector.addDetector(std::unique_ptr<mtg::Detector>(new mtg::HullDetector()));
+    if (mOptions.squaresFallback)
+    {
+        mDetector.addDetector(std::unique_ptr<mtg::Detector>(new mtg::SquaresDetector(50, 11, true, mOptions.squaresPyramidLevels)));
+    }
 
-    return mFound;
+    CV_Assert(mRecentFramesMax <= kMaxRecentFrames);
+    mRecentFrames.reserve(mRecentFramesMax);
+
+    std::memset(&mStats, 0, sizeof(mStats));
 }
 
-void mtg::CardScanner::grabFrame()
+mtg::CardScanner::~CardScanner()
 {
-    cv::Mat frame, frameGray, frameFlipped;
-    mCamera->operator>>(frame);
-
-    cv::cvtColor(frame, frameGray, CV_BGR2GRAY);
-    mtg::flipImage(frame, frameFlipped);
-
-    if (mLastFrame.empty())
+    if (mCapture)
     {
-        mImageSize = frame.size();
-        mNumPixels = mImageSize.width * mImageSize.height;
+        mCapture->stop();
     }
+}
 
-    mRecentFrames.push_back(frame);
-    mRecentFramesGray.push_back(frameGray);
+bool mtg::CardScanner::checkForCard(cv::Mat &_detectedCard)
+{
+    processFrame();
+    rectifyCards(mQuads);
 
-    if ((int32_t)mRecentFrames.size() > mRecentFramesMax)
+    if (!mSnapshots.empty())
     {
-        mRecentFrames.pop_front();
-        mRecentFramesGray.pop_front();
+        _detectedCard = mSnapshots.front().clone();
     }
 
-    mLastFrame = frame.clone();
-    mLastFrameGray = frameGray;
-    mLastFrameFlipped = frameFlipped;
+    return !mSnapshots.empty();
 }
 
-void mtg::CardScanner::updateBackground()
+uint32_t mtg::CardScanner::checkForCards(std::vector<cv::Mat> &_detectedCards)
 {
-    if (mBackground.empty())
+    processFrame();
+    rectifyCards(mQuads);
+
+    _detectedCards.resize(mSnapshots.size());
+    for (int32_t c = 0; c < (int32_t)mSnapshots.size(); c++)
     {
-        mBackground = mLastFrame.clone();
-        cv::cvtColor(mBackground, mBackgroundGray, CV_BGR2GRAY);
-        mtg::flipImage(mBackground, mBackgroundFlipped);
+        _detectedCards.at(c) = mSnapshots.at(c).clone();
     }
+
+    return mSnapshots.size();
 }
 
-void mtg::CardScanner::checkForMovement()
+uint32_t mtg::CardScanner::checkForQuads(std::vector< std::vector<cv::Point2f> > &_quads, mtg::FramePtr &_frame)
 {
-    if (calculateBiggestDifference() > 10)
+    processFrame();
+
+    _quads = mQuads;
+    _frame = mFrame;
+    return mQuads.size();
+}
+
+void mtg::CardScanner::processFrame()
+{
+    mQuads.clear();
+
+    if (mFinished || !grabFrame())
     {
-        mHasMoved = true;
+        mFinished = true;
+        return;
+    }
 
-        mtg_debug("movement detected inside calculateBiggestDifference");
+    mStats.numFrames++;
+    updateBackground();
+
+    if (!mTracking || !trackCard())
+    {
+        checkForMovement();
     }
-    else if (mHasMoved)
+}
+
+int64_t mtg::CardScanner::getFrameTimestamp() const
+{
+    return mFrameTimestamp;
+}
+
+uint64_t mtg::CardScanner::getDroppedFrames() const
+{
+    return mCapture ? mCapture->getDroppedFrames() : 0;
+}
+
+mtg::ScannerStats const &mtg::CardScanner::getStats() const
+{
+    return mStats;
+}
+
+std::vector<mtg::DetectorStats> const &mtg::CardScanner::getDetectorStats() const
+{
+    return mDetector.getStats();
+}
+
+uint64_t mtg::CardScanner::getCardId() const
+{
+    return mCardId;
+}
+
+bool mtg::CardScanner::isTracking() const
+{
+    return mTracking;
+}
+
+bool mtg::CardScanner::isFinished() const
+{
+    return mFinished;
+}
+
+bool mtg::CardScanner::grabFrame()
+{
+    mtg::FramePtr frame = mFramePool.acquire();
+    if (mCapture)
     {
-        if (calculateBackgroundSimilarity() > 0.75f)
+        // the ring slot is only ours until the next call, so it is copied into the pooled buffer
+        cv::Mat captured;
+        if (!mCapture->getLatestFrame(captured, frame->timestampMicroseconds))
         {
-            mHasMoved = false;
-            mtg_debug("false alarm...");
+            return false;
         }
-        else
+        captured.copyTo(frame->color);
+    }
+    else
+    {
+        if (!mSource->read(frame->color))
         {
-            std::vector<cv::Point2f> corners;
-            mtg_debug("running detectCard...");
-            detectCard(mLastFrameGray, mBackgroundGray, corners);
-            if (corners.size() > 0)
-            {
-                std::vector<cv::Point2f>::const_iterator cornersIdx = corners.begin();
-                while (cornersIdx != corners.end())
-                {
-                    mtg_debug("Corner: " << cornersIdx->x << ", " << cornersIdx->y);
-                    cornersIdx++;
-                }
-                getRectifiedCard(mLastFrame, corners);
-                mFound = true;
-            }
-            else
-            {
-                mtg_debug("a card was not found");
-            }
+            return false;
+        }
 
-            mHasMoved = false;
+        frame->timestampMicroseconds = mSource->getFrameTimestamp();
+        if (frame->timestampMicroseconds == 0)
+        {
+            frame->timestampMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
         }
     }
+
+    if (!mFrame)
+    {
+        mImageSize = frame->color.size();
+        mMotionSize = cv::Size(mOptions.motionWidth, std::max(1, mOptions.motionWidth * mImageSize.height / mImageSize.width));
+    }
+
+    mFrame = frame;
+    mFrameTimestamp = frame->timestampMicroseconds;
+
+    // oldest first, rotated in place once full so the history never reallocates
+    if ((int32_t)mRecentFrames.size() < mRecentFramesMax)
+    {
+        mRecentFrames.push_back(frame);
+    }
+    else
+    {
+        std::rotate(mRecentFrames.begin(), mRecentFrames.begin() + 1, mRecentFrames.end());
+        mRecentFrames.back() = frame;
+    }
+
+    return true;
 }
 
-void mtg::CardScanner::detectCard(cv::Mat const &_gray, cv::Mat const &_grayBase, std::vector<cv::Point2f> &_corners)
+cv::Mat const &mtg::CardScanner::getMotionGray(mtg::FramePtr const &_frame)
 {
-    typedef struct Line {
-        cv::Point2f c0;
-        cv::Point2f c1;
-        float length;
-        float angle;
-    } Line;
-
-    _corners.clear();
-
-    // initial filtering
-    mtg_debug("filtering");
-    cv::Mat difference = _gray.clone();
-    cv::absdiff(_gray, _grayBase, difference);
-
-    cv::Mat edges = _gray.clone();
-    cv::Canny(difference, edges, 100, 100);
-
-    // find contours
-    mtg_debug("finding contours");
-    std::vector< std::vector<cv::Point> > contours;
-    cv::findContours(edges, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
-
-    // extract edge points
-    std::vector<cv::Point2f> edgePoints;
-    for (int32_t c = 0; c < (int32_t)contours.size(); c++)
+    return mOptions.lowResolutionMotion ? _frame->getSmallGray(mMotionSize) : _frame->getGray();
+}
+
+cv::Rect mtg::CardScanner::getMotionRegion()
+{
+    cv::Rect const frameRect(cv::Point(0, 0), mImageSize);
+    if (!mOptions.cropToMotion)
+    {
+        return frameRect;
+    }
+
+    cv::Mat const &frameGray = getMotionGray(mFrame);
+    cv::Mat const &background = mOptions.lowResolutionMotion ? mBackgroundSmallGray : mBackgroundGray;
+
+    int32_t left = frameGray.cols, right = -1, top = frameGray.rows, bottom = -1;
+    for (int32_t j = 0; j < frameGray.rows; j++)
     {
-        if (contours.at(c).size() > 10)
+        uint8_t const *row = frameGray.ptr<uint8_t>(j);
+        uint8_t const *base = background.ptr<uint8_t>(j);
+        for (int32_t i = 0; i < frameGray.cols; i++)
         {
-            for (int32_t cc = 0; cc < (int32_t)contours.at(c).size(); cc++)
+            if (std::abs(int32_t(row[i]) - int32_t(base[i])) > kMotionPixelThreshold)
             {
-                edgePoints.push_back(contours.at(c).at(cc));
+                left = std::min(left, i);
+                right = std::max(right, i);
+                top = std::min(top, j);
+                bottom = std::max(bottom, j);
             }
         }
     }
 
-    if (edgePoints.size() == 0)
+    if (right < 0)
     {
-        mtg_debug("edgePoints.size() == 0");
-        return;
-    }
-    else
-    {
-        mtg_debug("we may have found a card");
+        return frameRect;
     }
 
-    // wrap convex hull around contours
-    mtg_debug("convex hull");
-    std::vector<cv::Point2f> hull;
-    cv::convexHull(edgePoints, hull, true);
+    // scale the box up to the full frame and pad it, the gate frames are area averaged so edges blur
+    float const scaleX = float(mImageSize.width) / float(frameGray.cols);
+    float const scaleY = float(mImageSize.height) / float(frameGray.rows);
+    float const padX = kMotionRegionPadding * mImageSize.width;
+    float const padY = kMotionRegionPadding * mImageSize.height;
 
-    // convert into lines
-    mtg_debug("converting lines");
-    std::vector<Line> lines(hull.size());
-    for (int32_t l = 0; l < (int32_t)hull.size(); l++)
-    {
-        cv::Point2f const p0 = cv::Point2f(hull.at(l).x, hull.at(l).y);
-        cv::Point2f const p1 = cv::Point2f(hull.at((l + 1) % hull.size()).x, hull.at((l + 1) % hull.size()).y);
-
-        Line line;
-        line.c0 = p0;
-        line.c1 = p1;
-        line.length = std::sqrt(std::pow(p1.x - p0.x, 2.f) + std::pow(p1.y - p0.y, 2.f));
-        line.angle  = std::atan2(p1.y - p0.y, p1.x - p0.x);
-        lines.at(l) = line;
-    }
+    cv::Point const topLeft(std::floor(left * scaleX - padX), std::floor(top * scaleY - padY));
+    cv::Point const bottomRight(std::ceil((right + 1) * scaleX + padX), std::ceil((bottom + 1) * scaleY + padY));
+    return cv::Rect(topLeft, bottomRight) & frameRect;
+}
 
-    // straighten out lines
-    mtg_debug("straightening out lines");
-    int32_t lIdx = 0;
-    while (lIdx + 1 < lines.size())
+void mtg::CardScanner::updateBackground()
+{
+    if (mBackground.empty())
     {
-        Line l0 = lines.at(lIdx);
-        Line l1 = lines.at((lIdx + 1) % lines.size());
+        mBackground = mFrame->color.clone();
+        mFrame->getGray().copyTo(mBackgroundGray);
 
-        if (std::fabs(l0.angle - l1.angle) / (CV_PI * 2.f) < 0.0027)
+        if (mOptions.lowResolutionMotion)
         {
-            cv::Point2f const &p0 = l0.c0;
-            cv::Point2f const &p1 = l1.c1;
-
-            Line line;
-            line.c0 = p0;
-            line.c1 = p1;
-            line.length = std::sqrt(std::pow(p1.x - p0.x, 2.f) + std::pow(p1.y - p0.y, 2.f));
-            line.angle  = std::atan2(p1.y - p0.y, p1.x - p0.x);
-            lines.at(lIdx) = line;
-            lines.erase(lines.begin() + lIdx + 1);
+            mFrame->getSmallGray(mMotionSize).copyTo(mBackgroundSmallGray);
         }
-        else
+
+        if (mOptions.adaptiveBackground)
         {
-            lIdx++;
+            mBackground.convertTo(mBackgroundModel, CV_32F);
+            mBackgroundSmallGray.convertTo(mBackgroundSmallModel, CV_32F);
         }
+
+        // the background only changes here and in blendBackground, so its half of the correlation is computed once
+        mtg::getImageMoments(mOptions.lowResolutionMotion ? mBackgroundSmallGray : mBackgroundGray, mBackgroundMoments);
     }
+}
 
-    // sort the lines
-    mtg_debug("sorting lines");
-    std::sort(lines.begin(), lines.end(),
-        [](Line const &lhs, Line const &rhs) {
-            return lhs.length > rhs.length;
-        });
+void mtg::CardScanner::blendBackground()
+{
+    cv::Mat const &frameGray = getMotionGray(mFrame);
+    cv::Mat const &backgroundGray = mOptions.lowResolutionMotion ? mBackgroundSmallGray : mBackgroundGray;
 
-    // compute perimeter
-    mtg_debug("computing perimeter");
-    float perimeter = std::accumulate(lines.begin(), lines.end(), float{},
-        [](float result, Line const &line) {
-            return result + line.length;
-        });
+    // a static scene that no longer correlates with the background holds something new, most
+    // likely a card that was just scanned, which must not fade into the model
+    if (mtg::coeffNormed(backgroundGray, mBackgroundMoments, frameGray) < mOptions.backgroundSimilarityThreshold)
+    {
+        return;
+    }
 
-    mtg_debug("Perimeter after detection = " << perimeter);
+    mStaticFrames++;
+    bool changed = false;
+
+    if (mOptions.lowResolutionMotion)
+    {
+        cv::accumulateWeighted(frameGray, mBackgroundSmallModel, mOptions.backgroundLearningRate);
+        mBackgroundSmallModel.convertTo(mBackgroundSmallGray, CV_8U);
+        changed = true;
+    }
 
-    if (perimeter > 700)
+    if (mStaticFrames % mOptions.backgroundFullUpdateInterval == 0)
     {
-        std::vector<Line> firstFourLines;
-        firstFourLines.push_back(lines.at(0));
-        firstFourLines.push_back(lines.at(1));
-        firstFourLines.push_back(lines.at(2));
-        firstFourLines.push_back(lines.at(3));
-
-        float const firstFourSum = std::accumulate(firstFourLines.begin(), firstFourLines.end(), float{},
-            [](float result, const Line &line) {
-                return result + line.length;
-            });
-
-        if (firstFourSum / perimeter > 0.7f)
+        // one blend standing in for backgroundFullUpdateInterval skipped ones
+        double const rate = 1.0 - std::pow(1.0 - mOptions.backgroundLearningRate, mOptions.backgroundFullUpdateInterval);
+        cv::accumulateWeighted(mFrame->color, mBackgroundModel, rate);
+        mBackgroundModel.convertTo(mBackground, CV_8U);
+        cv::cvtColor(mBackground, mBackgroundGray, CV_BGR2GRAY);
+        changed = true;
+    }
+
+    if (changed)
+    {
+        mtg::getImageMoments(backgroundGray, mBackgroundMoments);
+        mStats.numBackgroundUpdates++;
+    }
+}
+
+void mtg::CardScanner::checkForMovement()
+{
+    if (calculateBiggestDifference() > 10)
+    {
+        if (!mHasMoved)
         {
-            std::vector<cv::Point2f> corners(4);
-            std::vector<Line> sides = firstFourLines;
-            std::sort(sides.begin(), sides.end(),
-                [](Line const &lhs, Line const &rhs) {
-                    return lhs.angle > rhs.angle;
-                });
-
-            for (int32_t i = 0; i < 4; i++)
+            mStats.numMotionEvents++;
+        }
+        mHasMoved = true;
+        mHeldQuads.clear();
+
+        mtg_debug("movement detected inside calculateBiggestDifference");
+    }
+    else if (mHasMoved)
+    {
+        if (calculateBackgroundSimilarity() > mOptions.backgroundSimilarityThreshold)
+        {
+            mHasMoved = false;
+            mVerifiedCorners.clear();
+            mStats.numFalseTriggers++;
+            mtg_debug("false alarm...");
+        }
+        else
+        {
+            mtg::CardQuads quads;
+            cv::Rect const region = getMotionRegion();
+            mtg_debug("running the detectors on " << region.width << "x" << region.height << " at " << region.x << ", " << region.y);
+            mStats.numDetections++;
+
+            mtg::DetectorInput input;
+            input.gray = mFrame->getGray()(region);
+            input.grayBase = mBackgroundGray(region);
+            input.color = mFrame->color(region);
+            input.maxCards = mOptions.maxCards;
+            mDetector.detect(input, quads);
+
+            if (quads.size() > 0)
             {
-                // find where the lines intersect to get true corner points for the rectangle
-                auto intersectLine = [&](Line const &s0, Line const &s1)
+                // detection saw the region only, bring the corners back to frame coordinates
+                for (int32_t q = 0; q < (int32_t)quads.size(); q++)
                 {
-                    float const x1 = s0.c0.x, y1 = s0.c0.y;
-                    float const x2 = s0.c1.x, y2 = s0.c1.y;
-                    float const x3 = s1.c0.x, y3 = s1.c0.y;
-                    float const x4 = s1.c1.x, y4 = s1.c1.y;
-                    float const denom = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
-
-                    if (denom == 0)
+                    for (int32_t c = 0; c < (int32_t)quads.at(q).size(); c++)
                     {
-                        return cv::Point2f(-1, -1);
+                        quads.at(q).at(c) += cv::Point2f(region.tl());
                     }
+                }
 
-                    float const x = ((x1 * y2 - y1 * x2) * (x3 - x4) - (x1 - x2) * (x3 * y4 - y3 * x4)) / float(denom);
-                    float const y = ((x1 * y2 - y1 * x2) * (y3 - y4) - (y1 - y2) * (x3 * y4 - y3 * x4)) / float(denom);
-
-                    return cv::Point2f(x, y);
-                };
+                mQuads = quads;
 
-                corners.at(i) = intersectLine(sides.at(i), sides.at((i + 1) % 4));
-            }
+                // a tracked card found again where tracking left it is the same card, not a new one
+                if (mVerifiedCorners.empty() || quads.size() != 1 || !isSameCard(quads.front(), mVerifiedCorners))
+                {
+                    mStats.numCardsFound += quads.size();
+                    mCardId++;
+                }
 
-            std::vector<cv::Point2f>::const_iterator cornersIdx = corners.begin();
-            while (cornersIdx != corners.end())
-            {
-                if (cornersIdx->x == -1 || cornersIdx->y == -1)
+                if (mOptions.trackCards && quads.size() == 1)
                 {
-                    mtg_debug("corners were -1, -1");
+                    mTracking = true;
+                    mTrackedCorners = quads.front();
+                    mTrackedArea = cv::contourArea(mTrackedCorners);
+                    mTrackedFrames = 0;
+                    mFrame->getGray().copyTo(mTrackGray);
                 }
-                cornersIdx++;
+                else if (mOptions.trackCards)
+                {
+                    mHeldQuads = quads;
+                    mTrackedFrames = 0;
+                }
+            }
+            else
+            {
+                mStats.numFalseTriggers++;
+                mtg_debug("a card was not found");
             }
 
-            reorderCornerVertices(corners);
-            _corners = corners;
+            mVerifiedCorners.clear();
+            mHasMoved = false;
         }
-        else
+    }
+    else
+    {
+        // several cards are not followed by optical flow, but while nothing moves they are
+        // still where they were found, so the recognizer keeps getting snapshots to fuse
+        if (!mHeldQuads.empty())
         {
-            mtg_debug("Made it all the way to the last step, but the perimeter wasn't a sufficient size.");
+            if (mOptions.maxTrackedFrames > 0 && mTrackedFrames >= mOptions.maxTrackedFrames)
+            {
+                mHeldQuads.clear();
+            }
+            else
+            {
+                mQuads = mHeldQuads;
+                mTrackedFrames++;
+                mStats.numTrackedFrames++;
+            }
+        }
+
+        if (mOptions.adaptiveBackground)
+        {
+            blendBackground();
         }
     }
 }
 
-void mtg::CardScanner::getRectifiedCard(cv::Mat const &_inputColor, std::vector<cv::Point2f> const &_corners)
+void mtg::CardScanner::rectifyCards(std::vector< std::vector<cv::Point2f> > const &_quads)
 {
-    // order is guaranteed from mtg::reorderSquareVertices
-    cv::Point2f topLeft     = _corners.at(0);
-    cv::Point2f bottomLeft  = _corners.at(1);
-    cv::Point2f bottomRight = _corners.at(2);
-    cv::Point2f topRight    = _corners.at(3);
-
-    // gather target width and height based on rect dimensions
-    float const width0  = std::sqrt(std::powf(bottomRight.x - bottomLeft.x, 2.f) + std::powf(bottomRight.y - bottomLeft.y, 2.f));
-    float const width1  = std::sqrt(std::powf(topRight.x - topLeft.x, 2.f) + std::powf(topRight.y - topLeft.y, 2.f));
-    float const height0 = std::sqrt(std::powf(topRight.x - bottomRight.x, 2.f) + std::powf(topRight.y - bottomRight.y, 2.f));
-    float const height1 = std::sqrt(std::powf(topLeft.x - bottomLeft.x, 2.f) + std::powf(topLeft.y - bottomLeft.y, 2.f));
-
-    // NOTE: why is this transposed?
-    int32_t const maxWidth = std::roundf(std::max(height0, height1));
-    int32_t const maxHeight = std::roundf(std::max(width0, width1));
-
-    std::vector<cv::Point2f> sourceRect;
-    sourceRect.push_back(topLeft);
-    sourceRect.push_back(bottomLeft);
-    sourceRect.push_back(bottomRight);
-    sourceRect.push_back(topRight);
-
-    std::vector<cv::Point2f> destRect;
-    destRect.push_back(cv::Point2f(0, 0));
-    destRect.push_back(cv::Point2f(0, maxHeight));
-    destRect.push_back(cv::Point2f(maxWidth, maxHeight));
-    destRect.push_back(cv::Point2f(maxWidth, 0));
-
-    // probably not needed, but here to be extra safe
-    // ----------------------------------------------
-    reorderCornerVertices(destRect);
-    // ----------------------------------------------
-
-    // allocate output image and perform perspective warp to rectify square image
-    mSnapshot = cv::Mat(cv::Size(maxWidth, maxHeight), _inputColor.type());
-    cv::Mat perspective = cv::getPerspectiveTransform(cv::Mat(sourceRect), cv::Mat(destRect));
-    cv::warpPerspective(_inputColor, mSnapshot, perspective, cv::Size(maxWidth, maxHeight));
-    cv::resize(mSnapshot, mSnapshot, cv::Size(222, 311));
-    mtg::flipImage(mSnapshot, mSnapshot);
+    mSnapshots.resize(_quads.size());
+
+    cv::Mat const &color = mFrame->color;
+    mtg::ThreadPool::getGlobalPool().parallelFor(_quads.size(), [&](uint32_t _q) {
+        mtg::rectifyCard(color, _quads.at(_q), mSnapshots.at(_q));
+    });
 }
 
-int32_t mtg::CardScanner::calculateBiggestDifference()
+bool mtg::CardScanner::trackCard()
 {
-    float maxDifference = 0;
-    for (int32_t img = 0; img < (int32_t)mRecentFramesGray.size(); img++)
+    // optical flow happily follows a card that was swapped or covered in place, so every so
+    // often tracking ends as if the card had just moved and the detectors have to find it again
+    if (mOptions.maxTrackedFrames > 0 && mTrackedFrames >= mOptions.maxTrackedFrames)
     {
-        cv::Mat const &image = mRecentFramesGray.at(img);
-        maxDifference = std::max(mtg::sumSquared(mLastFrameGray, image) / mNumPixels, maxDifference);
+        mtg_debug("re-verifying card " << mCardId << " after " << mTrackedFrames << " tracked frames");
+        mTracking = false;
+        mVerifiedCorners = mTrackedCorners;
+        mHasMoved = true;
+        mStats.numReverifications++;
+        return false;
     }
 
-    return maxDifference;
-}
+    cv::Mat const &gray = mFrame->getGray();
 
-float mtg::CardScanner::calculateBackgroundSimilarity()
-{
-    float minSim = FLT_MAX / 2;
-    for (int32_t img = 0; img < (int32_t)mRecentFramesGray.size(); img++)
+    std::vector<cv::Point2f> corners;
+    std::vector<uint8_t> status;
+    std::vector<float> error;
+    cv::calcOpticalFlowPyrLK(mTrackGray, gray, mTrackedCorners, corners, status, error, cv::Size(21, 21), 3);
+
+    // every corner has to be found, look like it did and stay in frame, and the card has to keep
+    // its shape without jumping in size since the previous frame
+    bool tracked = corners.size() == mTrackedCorners.size();
+    cv::Rect const frameRect(cv::Point(0, 0), mImageSize);
+    for (int32_t c = 0; c < (int32_t)corners.size() && tracked; c++)
     {
-        cv::Mat const &image = mRecentFramesGray.at(img);
-        minSim = std::min(mtg::coeffNormed(mBackgroundGray, image), minSim);
+        tracked = status.at(c) != 0 && error.at(c) < kMaxTrackingError && frameRect.contains(corners.at(c));
     }
 
-    return minSim;
-}
+    float const area = tracked ? cv::contourArea(corners) : 0.f;
+    tracked = tracked && cv::isContourConvex(corners) &&
+              area * kMaxTrackedAreaChange > mTrackedArea && area < mTrackedArea * kMaxTrackedAreaChange;
 
-void mtg::CardScanner::reorderCornerVertices(std::vector<cv::Point2f> &_corners)
-{
-    // to simulate in-place modification
-    std::vector<cv::Point2f> rect = _corners;
-
-    // topLeft will always have the smallest sum
-    // bottomLeft will always have the largest difference
-    // bottomRight will always have the largest sum
-    // topRight will always have the smallest difference
-
-    int32_t smallSum  = +INT_MAX / 2, smallSumIndex  = -1;
-    int32_t largeSum  = -INT_MAX / 2, largeSumIndex  = -1;
-    int32_t smallDiff = +INT_MAX / 2, smallDiffIndex = -1;
-    int32_t largeDiff = -INT_MAX / 2, largeDiffIndex = -1;
-    for (int32_t pt = 0; pt < (int32_t)rect.size(); pt++)
+    if (!tracked)
     {
-        int32_t const sum  = rect.at(pt).x + rect.at(pt).y;
-        int32_t const diff = rect.at(pt).x - rect.at(pt).y;
-        if (sum < smallSum)
-        {
-            smallSum = sum;
-            smallSumIndex = pt;
-        }
+        mtg_debug("lost track of card " << mCardId);
+        mTracking = false;
+        mStats.numTrackingLost++;
+        return false;
+    }
 
-        if (sum > largeSum)
-        {
-            largeSum = sum;
-            largeSumIndex = pt;
-        }
+    mTrackedCorners = corners;
+    mTrackedArea = area;
+    mTrackedFrames++;
+    gray.copyTo(mTrackGray);
 
-        if (diff < smallDiff)
-        {
-            smallDiff = diff;
-            smallDiffIndex = pt;
-        }
+    mQuads.assign(1, corners);
+    mStats.numTrackedFrames++;
+    return true;
+}
 
-        if (diff > largeDiff)
-        {
-            largeDiff = diff;
-            largeDiffIndex = pt;
-        }
+int32_t mtg::CardScanner::calculateBiggestDifference()
+{
+    return updateMotionAverage(getMotionGray(mFrame), kMotionAverageRate, mMotionAverage);
+}
+
+float mtg::CardScanner::calculateBackgroundSimilarity()
+{
+    cv::Mat const &background = mOptions.lowResolutionMotion ? mBackgroundSmallGray : mBackgroundGray;
+
+    float minSim = FLT_MAX / 2;
+    for (int32_t img = 0; img < (int32_t)mRecentFrames.size(); img++)
+    {
+        cv::Mat const &image = getMotionGray(mRecentFrames.at(img));
+        minSim = std::min(mtg::coeffNormed(background, mBackgroundMoments, image), minSim);
     }
 
-    cv::Point2f topLeft     = rect.at(smallSumIndex);
-    cv::Point2f bottomLeft  = rect.at(largeDiffIndex);
-    cv::Point2f bottomRight = rect.at(largeSumIndex);
-    cv::Point2f topRight    = rect.at(smallDiffIndex);
-
-    // ensure the corners will always hold the vertices in this order
-    _corners.clear();
-    _corners.push_back(topLeft);
-    _corners.push_back(bottomLeft);
-    _corners.push_back(bottomRight);
-    _corners.push_back(topRight);
+    return minSim;
 }
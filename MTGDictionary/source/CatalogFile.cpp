@@ -0,0 +1,243 @@
+//! ----------------------------------------------------------------------------
+//! CatalogFile.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "CatalogFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <unistd.h>
+
+#include "Log.h"
+
+namespace
+{
+    char const kMagic[8] = { 'M', 'T', 'G', 'C', 'A', 'T', 'L', 'G' };
+    uint32_t const kVersion = 3;
+
+    //! Record flag of images that could not be decoded, their hashes are left empty
+    uint32_t const kUnreadable = 1;
+
+    //! File layout: Header, then Header::count Records, then Header::stringsSize bytes of names
+    typedef struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t hashBits;
+        uint64_t count;
+        uint64_t stringsSize;
+    } Header;
+
+    typedef struct Record
+    {
+        mtg::CardHash hash;
+        mtg::ColorHash colorHash;
+        int64_t modifiedTime;
+        int64_t fileSize;
+        uint32_t fileNameOffset;
+        uint32_t fileNameLength;
+        uint32_t setNameOffset;
+        uint32_t setNameLength;
+        uint32_t flags;
+        uint32_t reserved;
+    } Record;
+
+    // the mapping is page aligned, so records can be read in place as long as nothing pads them off 8 bytes
+    static_assert(sizeof(Header) % 8 == 0 && sizeof(Record) % 8 == 0, "catalog records must stay 8 byte aligned");
+}
+
+mtg::CatalogFile::CatalogFile() :
+    mData(NULL),
+    mCount(0)
+{
+}
+
+mtg::CatalogFile::~CatalogFile()
+{
+    close();
+}
+
+bool mtg::CatalogFile::open(QString const &_path)
+{
+    close();
+
+    mFile.setFileName(_path);
+    if (!mFile.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    qint64 const fileSize = mFile.size();
+    if (fileSize < (qint64)sizeof(Header))
+    {
+        mtg_warn("Catalog file " << _path.toStdString() << " is truncated, ignoring it.");
+        mFile.close();
+        return false;
+    }
+
+    uchar const *data = mFile.map(0, fileSize);
+    if (data == NULL)
+    {
+        mtg_warn("Unable to map catalog file " << _path.toStdString() << ".");
+        mFile.close();
+        return false;
+    }
+
+    Header header;
+    std::memcpy(&header, data, sizeof(Header));
+
+    // the count is bounded by the file size before it is multiplied, so a corrupt header cannot overflow the size check
+    uint64_t const bodySize = fileSize - sizeof(Header);
+    uint64_t const maxCount = std::min<uint64_t>(bodySize / sizeof(Record), std::numeric_limits<uint32_t>::max());
+    bool valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+                 header.version == kVersion &&
+                 header.hashBits == mtg::CardHash::kBits &&
+                 header.count <= maxCount &&
+                 bodySize - header.count * sizeof(Record) == header.stringsSize;
+
+    // every name has to lie inside the string table before any record is handed out
+    Record const *records = reinterpret_cast<Record const *>(data + sizeof(Header));
+    for (uint64_t r = 0; r < header.count && valid; r++)
+    {
+        valid = (uint64_t)records[r].fileNameOffset + records[r].fileNameLength <= header.stringsSize &&
+                (uint64_t)records[r].setNameOffset + records[r].setNameLength <= header.stringsSize;
+    }
+
+    if (!valid)
+    {
+        mtg_warn("Catalog file " << _path.toStdString() << " is stale or corrupt, ignoring it.");
+        mFile.unmap(const_cast<uchar *>(data));
+        mFile.close();
+        return false;
+    }
+
+    mData = data;
+    mCount = (uint32_t)header.count;
+    return true;
+}
+
+void mtg::CatalogFile::close()
+{
+    if (mData != NULL)
+    {
+        mFile.unmap(const_cast<uchar *>(mData));
+        mData = NULL;
+    }
+
+    mCount = 0;
+    mFile.close();
+}
+
+uint32_t mtg::CatalogFile::size() const
+{
+    return mCount;
+}
+
+void mtg::CatalogFile::getCard(uint32_t _r, mtg::Card &_card) const
+{
+    Record const &record = reinterpret_cast<Record const *>(mData + sizeof(Header))[_r];
+    char const *strings = reinterpret_cast<char const *>(mData + sizeof(Header) + mCount * sizeof(Record));
+
+    _card.fileName.assign(strings + record.fileNameOffset, record.fileNameLength);
+    _card.setName.assign(strings + record.setNameOffset, record.setNameLength);
+    _card.modifiedTime = record.modifiedTime;
+    _card.fileSize = record.fileSize;
+}
+
+mtg::CardHash const &mtg::CatalogFile::getHash(uint32_t _r) const
+{
+    return reinterpret_cast<Record const *>(mData + sizeof(Header))[_r].hash;
+}
+
+mtg::ColorHash const &mtg::CatalogFile::getColorHash(uint32_t _r) const
+{
+    return reinterpret_cast<Record const *>(mData + sizeof(Header))[_r].colorHash;
+}
+
+bool mtg::CatalogFile::isUnreadable(uint32_t _r) const
+{
+    return (reinterpret_cast<Record const *>(mData + sizeof(Header))[_r].flags & kUnreadable) != 0;
+}
+
+bool mtg::writeCatalogFile(QString const &_path, mtg::CardCatalog const &_catalog, std::vector<mtg::Card> const &_unreadable)
+{
+    assert(_catalog.cards.size() == _catalog.hashes.size() && _catalog.cards.size() == _catalog.colorHashes.size());
+
+    Header header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.hashBits = mtg::CardHash::kBits;
+    header.count = _catalog.cards.size() + _unreadable.size();
+    header.stringsSize = 0;
+
+    // the unreadable images follow the catalog cards, flagged and without hashes
+    std::vector<Record> records(header.count);
+    std::string strings;
+    for (int32_t c = 0; c < (int32_t)records.size(); c++)
+    {
+        bool const readable = c < (int32_t)_catalog.cards.size();
+        mtg::Card const &card = readable ? _catalog.cards.at(c) : _unreadable.at(c - _catalog.cards.size());
+
+        Record &record = records.at(c);
+        std::memset(&record, 0, sizeof(Record));
+        if (readable)
+        {
+            record.hash = _catalog.hashes.at(c);
+            record.colorHash = _catalog.colorHashes.at(c);
+        }
+        else
+        {
+            record.flags = kUnreadable;
+        }
+        record.modifiedTime = card.modifiedTime;
+        record.fileSize = card.fileSize;
+        record.fileNameOffset = strings.size();
+        record.fileNameLength = card.fileName.size();
+        strings += card.fileName;
+        record.setNameOffset = strings.size();
+        record.setNameLength = card.setName.size();
+        strings += card.setName;
+    }
+    header.stringsSize = strings.size();
+
+    // write beside the real file first, so a crash never leaves a half written catalog
+    QString const tempPath = _path + ".tmp";
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        mtg_error("Unable to write catalog file " << tempPath.toStdString() << ".");
+        return false;
+    }
+
+    qint64 const expected = sizeof(Header) + records.size() * sizeof(Record) + strings.size();
+    qint64 written = file.write(reinterpret_cast<char const *>(&header), sizeof(Header));
+    written += file.write(reinterpret_cast<char const *>(records.data()), records.size() * sizeof(Record));
+    written += file.write(strings.data(), strings.size());
+    bool const synced = file.flush() && ::fsync(file.handle()) == 0;
+    file.close();
+
+    if (written != expected || !synced)
+    {
+        mtg_error("Short write on catalog file " << tempPath.toStdString() << ".");
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    // rename(2) replaces the old file in one step, readers see either the old or the new catalog
+    if (std::rename(QFile::encodeName(tempPath).constData(), QFile::encodeName(_path).constData()) != 0)
+    {
+        mtg_error("Unable to move catalog file into place at " << _path.toStdString() << ".");
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,110 @@
+//! ----------------------------------------------------------------------------
+//! Display.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "Display.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <thread>
+
+namespace
+{
+    //! How often window events are pumped while the preview is off
+    int64_t const kIdleIntervalMicroseconds = 100000;
+
+    //! The rates are averaged over at least this long, so the readout does not flicker
+    int64_t const kRateIntervalMicroseconds = 1000000;
+
+    cv::Size const kPreviewSize(640, 480);
+
+    int64_t getMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void drawText(cv::Mat &_image, std::string const &_text, int32_t _line)
+    {
+        // dark outline first so the text stays readable on any background
+        cv::Point const origin(10, 24 + 24 * _line);
+        cv::putText(_image, _text, origin, cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(0, 0, 0), 3);
+        cv::putText(_image, _text, origin, cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(0, 255, 0), 1);
+    }
+}
+
+mtg::Display::Display(mtg::RecognitionPipeline const &_pipeline, double _previewFps) :
+    mPipeline(_pipeline),
+    mPreviewFps(_previewFps),
+    mInterval(_previewFps > 0.0 ? int64_t(1e6 / _previewFps) : kIdleIntervalMicroseconds),
+    mNextTick(getMicroseconds()),
+    mRateStart(getMicroseconds()),
+    mRateFramesStart(0),
+    mRateCapturedStart(0),
+    mScanFps(0.0),
+    mCaptureFps(0.0)
+{
+}
+
+void mtg::Display::showImage(std::string const &_window, cv::Mat const &_image)
+{
+    cv::imshow(_window, _image);
+}
+
+void mtg::Display::update()
+{
+    if (mPreviewFps > 0.0)
+    {
+        mtg::FramePtr const frame = mPipeline.getLatestFrame();
+        if (frame)
+        {
+            drawPreview(frame, getMicroseconds());
+        }
+    }
+
+    // only pumps the window events, nothing waits on a key
+    cv::waitKey(1);
+}
+
+void mtg::Display::waitForNextTick()
+{
+    // keep a steady pace, but never try to catch up on ticks that were missed
+    mNextTick = std::max(mNextTick + mInterval, getMicroseconds());
+    std::this_thread::sleep_for(std::chrono::microseconds(mNextTick - getMicroseconds()));
+}
+
+void mtg::Display::drawPreview(mtg::FramePtr const &_frame, int64_t _now)
+{
+    if (_now - mRateStart >= kRateIntervalMicroseconds)
+    {
+        mtg::PipelineStats const stats = mPipeline.getStats();
+        double const seconds = (_now - mRateStart) * 1e-6;
+        mScanFps = (stats.scanner.numFrames - mRateFramesStart) / seconds;
+        mCaptureFps = (stats.frames.numPushed - mRateCapturedStart) / seconds;
+
+        mRateStart = _now;
+        mRateFramesStart = stats.scanner.numFrames;
+        mRateCapturedStart = stats.frames.numPushed;
+    }
+
+    cv::resize(_frame->color, mPreview, kPreviewSize);
+
+    // latency of the frame on screen, from leaving the camera to being drawn here
+    char text[64];
+    std::snprintf(text, sizeof(text), "scan %.1f fps, camera %.1f fps", mScanFps, mCaptureFps);
+    drawText(mPreview, text, 0);
+    std::snprintf(text, sizeof(text), "latency %.0f ms", (_now - _frame->timestampMicroseconds) * 1e-3);
+    drawText(mPreview, text, 1);
+
+    cv::imshow("Camera Feed", mPreview);
+}
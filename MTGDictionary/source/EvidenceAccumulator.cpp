@@ -0,0 +1,122 @@
+//! ----------------------------------------------------------------------------
+//! EvidenceAccumulator.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "EvidenceAccumulator.h"
+
+namespace
+{
+    //! refinedDistance already includes distance, and is only 0 when both are
+    inline uint32_t getEvidenceDistance(mtg::CandidateMatch const &_candidate)
+    {
+        return _candidate.refinedDistance > 0 ? _candidate.refinedDistance : _candidate.distance;
+    }
+}
+
+mtg::EvidenceAccumulator::EvidenceAccumulator(uint32_t _margin, uint32_t _maxFrames) :
+    mMargin(_margin),
+    mMaxFrames(_maxFrames),
+    mNumFrames(0),
+    mPenaltySum(0),
+    mDecided(false)
+{
+}
+
+void mtg::EvidenceAccumulator::reset()
+{
+    mNumFrames = 0;
+    mPenaltySum = 0;
+    mDecided = false;
+    mEvidence.clear();
+}
+
+bool mtg::EvidenceAccumulator::addCandidates(std::vector<mtg::CandidateMatch> const &_candidates)
+{
+    if (mDecided || _candidates.empty())
+    {
+        return mDecided;
+    }
+
+    // anything this snapshot did not list is at least as far away as its worst candidate
+    uint32_t penalty = 0;
+    for (int32_t c = 0; c < (int32_t)_candidates.size(); c++)
+    {
+        penalty = std::max(penalty, getEvidenceDistance(_candidates.at(c)));
+    }
+
+    for (int32_t c = 0; c < (int32_t)_candidates.size(); c++)
+    {
+        mtg::CandidateMatch const &candidate = _candidates.at(c);
+
+        // a card first listed now was charged the penalty of every earlier snapshot
+        std::unordered_map<uint32_t, Evidence>::iterator it = mEvidence.find(candidate.index);
+        if (it == mEvidence.end())
+        {
+            Evidence const evidence = { 0, 0 };
+            it = mEvidence.insert(std::make_pair(candidate.index, evidence)).first;
+        }
+
+        it->second.distanceSum += getEvidenceDistance(candidate);
+        it->second.penaltySumWhenSeen += penalty;
+    }
+
+    mPenaltySum += penalty;
+    mNumFrames++;
+
+    mtg::EvidenceDecision const decision = getDecision();
+    mDecided = decision.confident || mNumFrames >= mMaxFrames;
+    return mDecided;
+}
+
+bool mtg::EvidenceAccumulator::isDecided() const
+{
+    return mDecided;
+}
+
+uint32_t mtg::EvidenceAccumulator::getNumFrames() const
+{
+    return mNumFrames;
+}
+
+mtg::EvidenceDecision mtg::EvidenceAccumulator::getDecision() const
+{
+    mtg::EvidenceDecision decision = { 0, 0, mNumFrames, false };
+
+    // cards never listed all score mPenaltySum, which bounds the runner up
+    uint64_t bestScore = UINT64_MAX, secondScore = mPenaltySum;
+    std::unordered_map<uint32_t, Evidence>::const_iterator it = mEvidence.begin();
+    for (; it != mEvidence.end(); it++)
+    {
+        uint64_t const score = getScore(it->second);
+        if (score < bestScore || (score == bestScore && it->first < decision.index))
+        {
+            secondScore = std::min(secondScore, bestScore);
+            bestScore = score;
+            decision.index = it->first;
+        }
+        else
+        {
+            secondScore = std::min(secondScore, score);
+        }
+    }
+
+    if (bestScore != UINT64_MAX)
+    {
+        decision.margin = secondScore - bestScore;
+        decision.confident = decision.margin >= mMargin;
+    }
+
+    return decision;
+}
+
+uint64_t mtg::EvidenceAccumulator::getScore(Evidence const &_evidence) const
+{
+    return _evidence.distanceSum + (mPenaltySum - _evidence.penaltySumWhenSeen);
+}
@@ -0,0 +1,177 @@
+//! ----------------------------------------------------------------------------
+//! FramePool.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "FramePool.h"
+
+#include "Log.h"
+
+mtg::Frame::Frame() :
+    timestampMicroseconds(0),
+    mHasGray(false),
+    mHasSmallGray(false)
+{
+}
+
+void mtg::Frame::reset()
+{
+    timestampMicroseconds = 0;
+    mHasGray = false;
+    mHasSmallGray = false;
+}
+
+cv::Mat const &mtg::Frame::getGray()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mHasGray)
+    {
+        cv::cvtColor(color, mGray, CV_BGR2GRAY);
+        mHasGray = true;
+    }
+
+    return mGray;
+}
+
+cv::Mat const &mtg::Frame::getSmallGray(cv::Size const &_size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mHasSmallGray || mSmallGray.size() != _size)
+    {
+        // area averaging first, so the conversion only touches the small image
+        cv::resize(color, mSmall, _size, 0, 0, cv::INTER_AREA);
+        cv::cvtColor(mSmall, mSmallGray, CV_BGR2GRAY);
+        mHasSmallGray = true;
+    }
+
+    return mSmallGray;
+}
+
+template <typename T>
+class mtg::FramePool::BlockAllocator
+{
+public:
+    typedef T value_type;
+
+    BlockAllocator(std::shared_ptr<Storage> const &_storage) :
+        mStorage(_storage)
+    {
+    }
+
+    template <typename U>
+    BlockAllocator(BlockAllocator<U> const &_other) :
+        mStorage(_other.mStorage)
+    {
+    }
+
+public:
+    T *allocate(size_t _count)
+    {
+        // every frame's reference count block has the same type, so any released one fits
+        if (_count == 1)
+        {
+            std::lock_guard<std::mutex> lock(mStorage->mutex);
+            if (!mStorage->freeBlocks.empty() && mStorage->blockSize == sizeof(T))
+            {
+                T *const block = static_cast<T *>(mStorage->freeBlocks.back());
+                mStorage->freeBlocks.pop_back();
+                return block;
+            }
+        }
+
+        return static_cast<T *>(::operator new(_count * sizeof(T)));
+    }
+
+    void deallocate(T *_block, size_t _count)
+    {
+        if (_count == 1)
+        {
+            std::lock_guard<std::mutex> lock(mStorage->mutex);
+            if (mStorage->freeBlocks.empty() || mStorage->blockSize == sizeof(T))
+            {
+                mStorage->blockSize = sizeof(T);
+                mStorage->freeBlocks.push_back(_block);
+                return;
+            }
+        }
+
+        ::operator delete(_block);
+    }
+
+    bool operator==(BlockAllocator const &_other) const
+    {
+        return mStorage == _other.mStorage;
+    }
+
+    bool operator!=(BlockAllocator const &_other) const
+    {
+        return mStorage != _other.mStorage;
+    }
+
+public:
+    //! Kept by the reference count block itself, so the free list outlives the last frame released into it
+    std::shared_ptr<Storage> mStorage;
+};
+
+mtg::FramePool::Storage::~Storage()
+{
+    for (int32_t b = 0; b < (int32_t)freeBlocks.size(); b++)
+    {
+        ::operator delete(freeBlocks.at(b));
+    }
+}
+
+mtg::FramePool::FramePool(uint32_t _numFrames) :
+    mStorage(std::make_shared<Storage>())
+{
+    mStorage->blockSize = 0;
+    mStorage->frames.reserve(_numFrames);
+    mStorage->freeFrames.reserve(_numFrames);
+    mStorage->freeBlocks.reserve(_numFrames);
+    for (uint32_t f = 0; f < _numFrames; f++)
+    {
+        mStorage->frames.push_back(std::unique_ptr<mtg::Frame>(new mtg::Frame()));
+        mStorage->freeFrames.push_back(mStorage->frames.back().get());
+    }
+}
+
+mtg::FramePtr mtg::FramePool::acquire()
+{
+    mtg::Frame *frame = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mStorage->mutex);
+        if (mStorage->freeFrames.empty())
+        {
+            mtg_debug("Every pooled frame is in use, growing the pool to " << mStorage->frames.size() + 1);
+            mStorage->frames.push_back(std::unique_ptr<mtg::Frame>(new mtg::Frame()));
+            frame = mStorage->frames.back().get();
+        }
+        else
+        {
+            frame = mStorage->freeFrames.back();
+            mStorage->freeFrames.pop_back();
+        }
+    }
+
+    // the free list lock orders the last holder's writes before this reuse
+    frame->reset();
+
+    // the allocator in the reference count block keeps the storage alive for the deleter
+    Storage *const storage = mStorage.get();
+    return mtg::FramePtr(frame, [storage](mtg::Frame *_frame) {
+        std::lock_guard<std::mutex> lock(storage->mutex);
+        storage->freeFrames.push_back(_frame);
+    }, BlockAllocator<mtg::Frame>(mStorage));
+}
+
+uint32_t mtg::FramePool::size() const
+{
+    std::lock_guard<std::mutex> lock(mStorage->mutex);
+    return mStorage->frames.size();
+}
@@ -0,0 +1,93 @@
+//! ----------------------------------------------------------------------------
+//! FrameSource.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "FrameSource.h"
+
+#include <QDir>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Log.h"
+
+mtg::FrameSource::~FrameSource()
+{
+}
+
+cv::Size mtg::FrameSource::getFrameSize() const
+{
+    return cv::Size();
+}
+
+int64_t mtg::FrameSource::getFrameTimestamp() const
+{
+    return 0;
+}
+
+mtg::VideoFrameSource::VideoFrameSource(cv::VideoCapture *_capture) :
+    mCapture(_capture)
+{
+}
+
+bool mtg::VideoFrameSource::read(cv::Mat &_frame)
+{
+    return mCapture->read(_frame) && !_frame.empty();
+}
+
+cv::Size mtg::VideoFrameSource::getFrameSize() const
+{
+    return cv::Size((int32_t)mCapture->get(CV_CAP_PROP_FRAME_WIDTH), (int32_t)mCapture->get(CV_CAP_PROP_FRAME_HEIGHT));
+}
+
+mtg::DirectoryFrameSource::DirectoryFrameSource(QString const &_directory) :
+    mDirectory(_directory),
+    mNext(0)
+{
+    QStringList filters;
+    filters << "*.png" << "*.jpg" << "*.jpeg" << "*.bmp";
+    mFiles = QDir(mDirectory).entryList(filters, QDir::Files, QDir::Name);
+}
+
+bool mtg::DirectoryFrameSource::read(cv::Mat &_frame)
+{
+    while (mNext < mFiles.size())
+    {
+        QString const path = mDirectory + "/" + mFiles.at(mNext++);
+        _frame = cv::imread(path.toStdString());
+        if (!_frame.empty())
+        {
+            if (mFrameSize.area() == 0)
+            {
+                mFrameSize = _frame.size();
+            }
+            else if (_frame.size() != mFrameSize)
+            {
+                mtg_warn("Frame " << path.toStdString() << " is " << _frame.cols << "x" << _frame.rows << ", resizing it to "
+                         << mFrameSize.width << "x" << mFrameSize.height << " like the first frame.");
+                cv::resize(_frame, _frame, mFrameSize);
+            }
+
+            return true;
+        }
+
+        mtg_warn("Unable to read frame " << path.toStdString() << ", skipping it.");
+    }
+
+    return false;
+}
+
+cv::Size mtg::DirectoryFrameSource::getFrameSize() const
+{
+    return mFrameSize;
+}
+
+uint32_t mtg::DirectoryFrameSource::size() const
+{
+    return mFiles.size();
+}
@@ -0,0 +1,227 @@
+//! ----------------------------------------------------------------------------
+//! HammingIndex.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include <cassert>
+
+#include "HammingIndex.h"
+
+namespace
+{
+    inline uint32_t getSubstring(mtg::CardHash const &_hash, uint32_t _table)
+    {
+        return (uint32_t)(_hash.words[0] >> (16 * _table)) & 0xffff;
+    }
+}
+
+mtg::HammingIndex::HammingIndex()
+    : mSize(0)
+{
+}
+
+void mtg::HammingIndex::build(std::vector<mtg::CardHash> const &_hashes)
+{
+    mSize = _hashes.size();
+
+    // bucket the hashes of every table by substring value, as a compressed offset array
+    for (uint32_t t = 0; t < kNumTables; t++)
+    {
+        std::vector<uint32_t> &start = mBucketStart[t];
+        std::vector<uint32_t> &items = mBucketItems[t];
+
+        start.assign(kNumBuckets + 1, 0);
+        for (uint32_t h = 0; h < mSize; h++)
+        {
+            start.at(getSubstring(_hashes.at(h), t) + 1)++;
+        }
+
+        for (uint32_t b = 0; b < kNumBuckets; b++)
+        {
+            start.at(b + 1) += start.at(b);
+        }
+
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        items.resize(mSize);
+        for (uint32_t h = 0; h < mSize; h++)
+        {
+            items.at(fill.at(getSubstring(_hashes.at(h), t))++) = h;
+        }
+    }
+}
+
+void mtg::HammingIndex::clear()
+{
+    mSize = 0;
+    for (uint32_t t = 0; t < kNumTables; t++)
+    {
+        mBucketStart[t].clear();
+        mBucketItems[t].clear();
+    }
+}
+
+bool mtg::HammingIndex::empty() const
+{
+    return mSize == 0;
+}
+
+uint32_t mtg::HammingIndex::size() const
+{
+    return mSize;
+}
+
+template <typename Visitor>
+void mtg::HammingIndex::probe(mtg::CardHash const *_hashes, mtg::CardHash const &_query, uint32_t _substringDistance, Visitor &_visitor) const
+{
+    uint32_t querySubstrings[kNumTables];
+    for (uint32_t t = 0; t < kNumTables; t++)
+    {
+        querySubstrings[t] = getSubstring(_query, t);
+    }
+
+    for (uint32_t t = 0; t < kNumTables; t++)
+    {
+        // walk every 16-bit mask with exactly _substringDistance bits set (Gosper's hack)
+        uint32_t mask = (1u << _substringDistance) - 1;
+        while (mask < kNumBuckets)
+        {
+            uint32_t const bucket = querySubstrings[t] ^ mask;
+            for (uint32_t i = mBucketStart[t][bucket]; i < mBucketStart[t][bucket + 1]; i++)
+            {
+                uint32_t const h = mBucketItems[t][i];
+                mtg::CardHash const &hash = _hashes[h];
+
+                // a hash is reachable from several tables and radii, only report it from
+                // the first table holding its closest substring so it is seen exactly once
+                bool firstVisit = true;
+                for (uint32_t other = 0; other < kNumTables && firstVisit; other++)
+                {
+                    uint32_t const d = mtg::popCount(getSubstring(hash, other) ^ querySubstrings[other]);
+                    firstVisit = d > _substringDistance || (d == _substringDistance && other >= t);
+                }
+
+                if (firstVisit)
+                {
+                    _visitor(h, mtg::getHammingDistance(_query, hash));
+                }
+            }
+
+            if (mask == 0)
+            {
+                break;
+            }
+
+            uint32_t const c = mask & (~mask + 1);
+            uint32_t const r = mask + c;
+            mask = (((r ^ mask) >> 2) / c) | r;
+        }
+    }
+}
+
+void mtg::HammingIndex::radiusSearch(std::vector<mtg::CardHash> const &_hashes, mtg::CardHash const &_query, uint32_t _radius, std::vector<mtg::CandidateMatch> &_matches) const
+{
+    assert(_hashes.size() == mSize);
+    _matches.clear();
+
+    auto visitor = [&](uint32_t _index, uint32_t _distance) {
+        if (_distance <= _radius)
+        {
+            mtg::CandidateMatch const match = { _index, _distance, 0 };
+            _matches.push_back(match);
+        }
+    };
+
+    // pigeonhole: a hash within _radius is within _radius / 4 in at least one substring
+    uint32_t const maxSubstringDistance = std::min<uint32_t>(_radius / kNumTables, uint32_t(kSubstringBits));
+    for (uint32_t s = 0; s <= maxSubstringDistance; s++)
+    {
+        probe(_hashes.data(), _query, s, visitor);
+    }
+
+    std::sort(_matches.begin(), _matches.end());
+}
+
+void mtg::HammingIndex::nearestSearch(std::vector<mtg::CardHash> const &_hashes, mtg::CardHash const &_query, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches) const
+{
+    assert(_hashes.size() == mSize);
+    _matches.clear();
+    _matches.reserve(_k);
+
+    if (_k == 0)
+    {
+        return;
+    }
+
+    auto visitor = [&](uint32_t _index, uint32_t _distance) {
+        mtg::CandidateMatch const match = { _index, _distance, 0 };
+        mtg::pushCandidate(_matches, _k, match);
+    };
+
+    // expected number of entries examined when probing every level up to s
+    double expectedExamined[kSubstringBits + 1];
+    double const entriesPerBucket = (double)mSize * kNumTables / kNumBuckets;
+    double masksAtDistance = 1.0;
+    for (uint32_t s = 0; s <= kSubstringBits; s++)
+    {
+        expectedExamined[s] = (s > 0 ? expectedExamined[s - 1] : 0.0) + masksAtDistance * entriesPerBucket;
+        masksAtDistance = masksAtDistance * (kSubstringBits - s) / (s + 1);
+    }
+
+    // grow the probed neighbourhood until nothing unseen can beat the current k-th match.
+    // Probing costs a random access per entry while the scan streams, so when the level
+    // the current k-th match still requires would examine more than a fraction of the
+    // catalog (sparse catalog or large k) a linear scan is the cheaper way to finish.
+    double const scanBudget = (double)mSize / kScanFallbackFraction;
+    for (uint32_t s = 0; s <= kSubstringBits; s++)
+    {
+        probe(_hashes.data(), _query, s, visitor);
+
+        uint32_t const coveredRadius = kNumTables * (s + 1) - 1;
+        if (coveredRadius >= mtg::CardHash::kBits)
+        {
+            break;
+        }
+
+        bool const full = _matches.size() == _k;
+        if (full && _matches.front().distance <= coveredRadius)
+        {
+            break;
+        }
+
+        // the exact-substring level alone says little about the k-th distance, so only trust it from level 1 on
+        uint32_t const requiredLevel = (full && s > 0) ? std::min<uint32_t>(_matches.front().distance / kNumTables, uint32_t(kSubstringBits)) : s + 1;
+        if (expectedExamined[requiredLevel] > scanBudget)
+        {
+            scanNearest(_hashes.data(), _query, _k, _matches);
+            return;
+        }
+    }
+
+    std::sort_heap(_matches.begin(), _matches.end());
+}
+
+void mtg::HammingIndex::scanNearest(mtg::CardHash const *_hashes, mtg::CardHash const &_query, uint32_t _k, std::vector<mtg::CandidateMatch> &_matches) const
+{
+    _matches.clear();
+
+    uint32_t distances[kScanBlockSize];
+    for (uint32_t begin = 0; begin < mSize; begin += kScanBlockSize)
+    {
+        uint32_t const count = std::min<uint32_t>(uint32_t(kScanBlockSize), mSize - begin);
+        mtg::scanHammingDistances(_query, _hashes + begin, count, distances);
+
+        for (uint32_t h = 0; h < count; h++)
+        {
+            mtg::CandidateMatch const match = { begin + h, distances[h], 0 };
+            mtg::pushCandidate(_matches, _k, match);
+        }
+    }
+
+    std::sort_heap(_matches.begin(), _matches.end());
+}
@@ -0,0 +1,114 @@
+//! ----------------------------------------------------------------------------
+//! ImageCache.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "ImageCache.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "Log.h"
+
+namespace
+{
+    inline size_t getImageBytes(cv::Mat const &_image)
+    {
+        return _image.total() * _image.elemSize();
+    }
+}
+
+mtg::ImageCache::ImageCache(size_t _maxBytes) :
+    mMaxBytes(_maxBytes),
+    mResidentBytes(0),
+    mHits(0),
+    mMisses(0)
+{
+}
+
+cv::Mat mtg::ImageCache::getImage(std::string const &_fileName)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        std::unordered_map<std::string, EntryList::iterator>::iterator found = mLookup.find(_fileName);
+        if (found != mLookup.end())
+        {
+            // move to the front, it is now the most recently used
+            mEntries.splice(mEntries.begin(), mEntries, found->second);
+            mHits++;
+            return found->second->second;
+        }
+
+        mMisses++;
+    }
+
+    // decode outside the lock, a slow read should not block hits on other images
+    cv::Mat image = cv::imread(_fileName);
+    if (image.empty())
+    {
+        mtg_warn("Unable to read card image " << _fileName << ".");
+        return image;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // another thread may have decoded the same image in the meantime
+    std::unordered_map<std::string, EntryList::iterator>::iterator found = mLookup.find(_fileName);
+    if (found != mLookup.end())
+    {
+        mEntries.splice(mEntries.begin(), mEntries, found->second);
+        return found->second->second;
+    }
+
+    mEntries.push_front(Entry(_fileName, image));
+    mLookup[_fileName] = mEntries.begin();
+    mResidentBytes += getImageBytes(image);
+    evict();
+
+    return image;
+}
+
+void mtg::ImageCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    mEntries.clear();
+    mLookup.clear();
+    mResidentBytes = 0;
+}
+
+size_t mtg::ImageCache::getResidentBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mResidentBytes;
+}
+
+uint64_t mtg::ImageCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHits;
+}
+
+uint64_t mtg::ImageCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMisses;
+}
+
+void mtg::ImageCache::evict()
+{
+    // always keep the newest entry, even if it alone is over budget
+    while (mResidentBytes > mMaxBytes && mEntries.size() > 1)
+    {
+        Entry const &oldest = mEntries.back();
+        mResidentBytes -= getImageBytes(oldest.second);
+        mLookup.erase(oldest.first);
+        mEntries.pop_back();
+    }
+}
@@ -11,55 +11,317 @@
 
 #include "CardScanner.h"
 #include "CardMatcher.h"
+#include "CardRecognizer.h"
+#include "Display.h"
+#include "ImageCache.h"
+#include "JsonUtility.h"
 #include "Log.h"
+#include "RecognitionPipeline.h"
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
 
-int32_t mainApplication(int argc, char **argv)
+//! usage: app [--cards N] [--preview-fps F] [--input <video file or frame directory>] [--output <results.jsonl>]
+//!
+//! Without --input the camera is scanned interactively, its feed previewed --preview-fps times a
+//! second (default 15, 0 for none) next to the processing rate and latency. With --input the recorded session is
+//! processed headless, as fast as it decodes, and every recognized card is written to --output
+//! (default results.jsonl) as a JSON line, followed by a throughput summary.
+
+namespace
 {
-    QApplication qt(argc, argv);
+    typedef struct Arguments
+    {
+        int32_t maxCards;
+        double previewFps;
+        std::string input;
+        std::string output;
+    } Arguments;
+
+    Arguments parseArguments(int argc, char **argv)
+    {
+        Arguments arguments;
+        arguments.maxCards = 1;
+        arguments.previewFps = 15.0;
+        arguments.output = "results.jsonl";
+
+        for (int32_t a = 1; a + 1 < argc; a++)
+        {
+            std::string const name = argv[a];
+            if (name == "--cards")
+            {
+                // look for up to N cards per frame, on a playmat or sorting tray
+                arguments.maxCards = std::max(1, std::atoi(argv[++a]));
+            }
+            else if (name == "--preview-fps")
+            {
+                // camera feed refresh rate, 0 turns the preview off
+                arguments.previewFps = std::max(0.0, std::atof(argv[++a]));
+            }
+            else if (name == "--input")
+            {
+                arguments.input = argv[++a];
+            }
+            else if (name == "--output")
+            {
+                arguments.output = argv[++a];
+            }
+        }
 
-    std::vector<mtg::Card> cardCache;
-    mtg::loadAllSets("./data", cardCache);
+        return arguments;
+    }
+
+    void loadCatalog(mtg::CardCatalog &_catalog)
+    {
+        mtg::loadAllSets("./data", _catalog, true, [](uint32_t _done, uint32_t _total) {
+            if (_done % 100 == 0 || _done == _total)
+            {
+                mtg_info("Hashed " << _done << " / " << _total << " card images");
+            }
+        });
+    }
+
+    mtg::ScannerOptions getScannerOptions(Arguments const &_arguments)
+    {
+        mtg::ScannerOptions options;
+        options.lowResolutionMotion = true;
+        options.adaptiveBackground = true;
+        options.cropToMotion = true;
+        options.trackCards = true;
+        options.maxCards = _arguments.maxCards;
+        options.squaresFallback = true;
+        options.squaresPyramidLevels = 1;
+        return options;
+    }
+
+    void logScannerStats(mtg::ScannerStats const &_stats)
+    {
+        mtg_debug("Scanner: " << _stats.numMotionEvents << " motion events, " << _stats.numDetections << " detections, "
+                  << _stats.numCardsFound << " cards, false trigger rate " << _stats.getFalseTriggerRate()
+                  << ", " << _stats.numBackgroundUpdates << " background updates, "
+                  << _stats.numTrackedFrames << " tracked frames, " << _stats.numTrackingLost << " times lost, "
+                  << _stats.numReverifications << " re-verifications");
+    }
 
-    cv::VideoCapture camera(0);
-    if (!camera.isOpened())
+    void logDetectorStats(std::vector<mtg::DetectorStats> const &_stats)
     {
-        mtg_error("Was not able to find/open camera.");
-        return EXIT_FAILURE;
+        for (int32_t d = 0; d < (int32_t)_stats.size(); d++)
+        {
+            mtg::DetectorStats const &stats = _stats.at(d);
+            mtg_debug("Detector " << stats.name << ": " << stats.numRuns << " runs, hit rate " << stats.getHitRate()
+                      << ", " << stats.numConfident << " confident, chosen " << stats.numChosen << " times, "
+                      << stats.getAverageMilliseconds() << " ms per run");
+        }
     }
 
-    camera.set(CV_CAP_PROP_FRAME_WIDTH, 1280);
-    camera.set(CV_CAP_PROP_FRAME_HEIGHT, 720);
+    void logQueueStats(char const *_name, mtg::QueueStats const &_stats)
+    {
+        mtg_debug("Queue " << _name << ": depth " << _stats.depth << "/" << _stats.capacity << ", average " << _stats.getAverageDepth()
+                  << ", max " << _stats.maxDepth << ", " << _stats.numBlocked << " blocked, " << _stats.numDropped << " dropped");
+    }
 
-    mtg_debug("Found camera, starting card detection...");
+    //! A queue that is mostly full feeds the bottleneck, one that is mostly empty follows it
+    void logPipelineStats(mtg::PipelineStats const &_stats)
+    {
+        logScannerStats(_stats.scanner);
+        logDetectorStats(_stats.detectors);
+        logQueueStats("frames", _stats.frames);
+        logQueueStats("quads", _stats.quads);
+        logQueueStats("cards", _stats.cards);
+        logQueueStats("hashes", _stats.hashes);
+        logQueueStats("recognitions", _stats.recognitions);
+        mtg_debug("Busy time: capture " << _stats.captureMicroseconds / 1000 << " ms, scan " << _stats.scanMicroseconds / 1000
+                  << " ms, rectify " << _stats.rectifyMicroseconds / 1000 << " ms, hash " << _stats.hashMicroseconds / 1000
+                  << " ms, match " << _stats.matchMicroseconds / 1000
+                  << " ms, " << _stats.numSkippedFrames << " frames of decided cards skipped");
+    }
 
-    mtg::CardScanner scanner(&camera);
+    mtg::PipelineOptions getPipelineOptions(Arguments const &_arguments)
+    {
+        mtg::PipelineOptions options;
+        options.scanner = getScannerOptions(_arguments);
+        return options;
+    }
 
-    cv::Mat card;
-    while (true)
+    void writeRecognition(std::ostream &_output, mtg::CardCatalog const &_catalog, mtg::Recognition const &_recognition)
     {
-        qt.processEvents();
+        mtg::Card const &card = _catalog.cards.at(_recognition.decision.index);
 
-        if (scanner.checkForCard(card))
+        // the distances of the decided card in the settling snapshot, null if it fell out of that snapshot's list
+        std::string distance = "null", refinedDistance = "null";
+        for (int32_t c = 0; c < (int32_t)_recognition.candidates.size(); c++)
         {
-            cv::imshow("Detected Card", card);
+            mtg::CandidateMatch const &candidate = _recognition.candidates.at(c);
+            if (candidate.index == _recognition.decision.index)
+            {
+                distance = std::to_string(candidate.distance);
+                refinedDistance = std::to_string(candidate.refinedDistance);
+                break;
+            }
+        }
 
-            std::vector<mtg::Card> candidates;
-            mtg::getCandidateMatches(card, cardCache, candidates);
-            std::for_each(candidates.begin(), candidates.end(), [](mtg::Card const &card) {
-                mtg_debug(card.fileName);
-            });
+        _output << "{\"frame\": " << _recognition.frame << ", \"card_id\": " << _recognition.cardId << ", \"slot\": " << _recognition.slot
+                << ", \"file\": \"" << mtg::escapeJson(card.fileName) << "\", \"set\": \"" << mtg::escapeJson(card.setName) << "\""
+                << ", \"distance\": " << distance << ", \"refined_distance\": " << refinedDistance
+                << ", \"margin\": " << _recognition.decision.margin << ", \"frames\": " << _recognition.decision.numFrames
+                << ", \"confident\": " << (_recognition.decision.confident ? "true" : "false") << "}\n";
+    }
 
-            cv::imshow("1st Place Candidate", candidates.at(0).image);
-            cv::imshow("2nd Place Candidate", candidates.at(1).image);
-            cv::imshow("3rd Place Candidate", candidates.at(2).image);
+    int32_t runHeadless(Arguments const &_arguments, mtg::CardCatalog const &_catalog)
+    {
+        std::unique_ptr<mtg::FrameSource> source;
+        cv::VideoCapture video;
+        if (QFileInfo(QString::fromStdString(_arguments.input)).isDir())
+        {
+            source.reset(new mtg::DirectoryFrameSource(QString::fromStdString(_arguments.input)));
+        }
+        else if (video.open(_arguments.input))
+        {
+            source.reset(new mtg::VideoFrameSource(&video));
+        }
+        else
+        {
+            mtg_error("Unable to open " << _arguments.input << " as a video or frame directory.");
+            return EXIT_FAILURE;
         }
 
-        cv::waitKey(33);
+        std::ofstream output(_arguments.output.c_str());
+        if (!output.is_open())
+        {
+            mtg_error("Unable to write results to " << _arguments.output << ".");
+            return EXIT_FAILURE;
+        }
+
+        // every recorded frame is processed, capture waits on the scanner instead of dropping frames
+        mtg::RecognitionPipeline pipeline(source.get(), _catalog, getPipelineOptions(_arguments));
+
+        std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+        pipeline.start();
+
+        uint64_t numRecognized = 0, numDecisionFrames = 0;
+        mtg::Recognition recognition;
+        while (pipeline.popRecognition(recognition))
+        {
+            writeRecognition(output, _catalog, recognition);
+            numRecognized++;
+            numDecisionFrames += recognition.decision.numFrames;
+        }
+
+        pipeline.stop();
+
+        double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        mtg::PipelineStats const stats = pipeline.getStats();
+        uint64_t const numFrames = stats.scanner.numFrames;
+        output << "{\"summary\": true, \"frames\": " << numFrames << ", \"seconds\": " << seconds
+               << ", \"frames_per_second\": " << numFrames / std::max(seconds, 1e-9)
+               << ", \"cards\": " << numRecognized
+               << ", \"cards_per_second\": " << numRecognized / std::max(seconds, 1e-9)
+               << ", \"frames_per_decision\": " << (numRecognized > 0 ? double(numDecisionFrames) / numRecognized : 0.0) << "}\n";
+
+        logPipelineStats(stats);
+        mtg_info("Processed " << numFrames << " frames in " << seconds << " s, recognized " << numRecognized
+                 << " cards, results written to " << _arguments.output);
+
+        return EXIT_SUCCESS;
     }
 
-    return EXIT_SUCCESS;
+    int32_t runInteractive(Arguments const &_arguments, mtg::CardCatalog const &_catalog)
+    {
+        mtg::ImageCache imageCache(kDefaultImageCacheBytes);
+
+        cv::VideoCapture camera(0);
+        if (!camera.isOpened())
+        {
+            mtg_error("Was not able to find/open camera.");
+            return EXIT_FAILURE;
+        }
+
+        camera.set(CV_CAP_PROP_FRAME_WIDTH, 1280);
+        camera.set(CV_CAP_PROP_FRAME_HEIGHT, 720);
+
+        mtg_debug("Found camera, starting card detection...");
+
+        // a slow stage makes capture skip ahead to the newest frame rather than fall behind the camera
+        mtg::VideoFrameSource source(&camera);
+        mtg::PipelineOptions options = getPipelineOptions(_arguments);
+        options.dropFrames = true;
+        mtg::RecognitionPipeline pipeline(&source, _catalog, options);
+        pipeline.start();
+
+        // HighGUI stays on the main thread that owns the QApplication, which polls the
+        // pipeline once per preview tick instead of blocking on it
+        mtg::Display display(pipeline, _arguments.previewFps);
+
+        std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+
+        uint64_t numRecognized = 0, numDecisionFrames = 0;
+        mtg::Recognition recognition;
+        while (!pipeline.isFinished())
+        {
+            while (pipeline.tryPopRecognition(recognition))
+            {
+                mtg::EvidenceDecision const &decision = recognition.decision;
+                mtg_debug("Card " << recognition.cardId << "/" << recognition.slot << " is " << _catalog.cards.at(decision.index).fileName
+                          << " after " << decision.numFrames << " frames, margin " << decision.margin
+                          << (decision.confident ? "" : " (not confident)"));
+
+                numRecognized++;
+                numDecisionFrames += decision.numFrames;
+                double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                mtg_debug("Average frames per decision: " << double(numDecisionFrames) / numRecognized << ", "
+                          << numRecognized / seconds << " cards/sec");
+                logPipelineStats(pipeline.getStats());
+
+                // catalog images are not kept resident, the cache decodes the few we display
+                std::vector<mtg::CandidateMatch> const &candidates = recognition.candidates;
+                uint32_t const best = decision.index;
+                display.showImage("Detected Card", recognition.snapshot);
+                display.showImage("1st Place Candidate", imageCache.getImage(_catalog.cards.at(best).fileName));
+                char const *windows[] = { "2nd Place Candidate", "3rd Place Candidate" };
+                for (int32_t c = 0, w = 0; c < (int32_t)candidates.size() && w < 2; c++)
+                {
+                    if (candidates.at(c).index != best)
+                    {
+                        display.showImage(windows[w++], imageCache.getImage(_catalog.cards.at(candidates.at(c).index).fileName));
+                    }
+                }
+            }
+
+            display.update();
+            QCoreApplication::processEvents();
+            display.waitForNextTick();
+        }
+
+        pipeline.stop();
+        return EXIT_SUCCESS;
+    }
+}
+
+int32_t mainApplication(int argc, char **argv)
+{
+    Arguments const arguments = parseArguments(argc, argv);
+
+    // headless runs must not need a display, so they only get a core application
+    if (!arguments.input.empty())
+    {
+        QCoreApplication qt(argc, argv);
+
+        mtg::CardCatalog catalog;
+        loadCatalog(catalog);
+        return runHeadless(arguments, catalog);
+    }
+
+    QApplication qt(argc, argv);
+
+    mtg::CardCatalog catalog;
+    loadCatalog(catalog);
+    return runInteractive(arguments, catalog);
 }
 
 int
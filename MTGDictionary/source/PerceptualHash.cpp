@@ -0,0 +1,131 @@
+//! ----------------------------------------------------------------------------
+//! PerceptualHash.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+
+#include "PerceptualHash.h"
+
+// 64-bit only, the kernels move whole 64-bit lanes in and out of general purpose registers.
+// The GCC/Clang target attributes and cpu builtins below also rule out _M_X64 (MSVC).
+#if defined(__x86_64__)
+#define MTG_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    void scanScalar(uint64_t const *_query, uint32_t _words, uint64_t const *_hashes, size_t _begin, size_t _count, uint32_t *_distances)
+    {
+        for (size_t h = _begin; h < _count; h++)
+        {
+            uint64_t const *hash = _hashes + h * _words;
+
+            uint32_t sum = 0;
+            for (uint32_t w = 0; w < _words; w++)
+            {
+                sum += mtg::popCount(_query[w] ^ hash[w]);
+            }
+
+            _distances[h] = sum;
+        }
+    }
+
+#if defined(MTG_X86_DISPATCH)
+    //! Checked once, the AVX2 kernels are compiled in regardless of -march and only run where supported
+    bool hasAvx2()
+    {
+        static bool const supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    //! Per-byte popcount using the nibble lookup table trick, summed into the four 64-bit lanes
+    __attribute__((target("avx2"))) inline __m256i popCount256(__m256i _v)
+    {
+        __m256i const lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        __m256i const lowMask = _mm256_set1_epi8(0x0f);
+
+        __m256i const lo = _mm256_and_si256(_v, lowMask);
+        __m256i const hi = _mm256_and_si256(_mm256_srli_epi16(_v, 4), lowMask);
+        __m256i const counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+        return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+    }
+
+    //! Returns how many hashes it covered, the rest is left to scanScalar
+    __attribute__((target("avx2"))) size_t scanAvx2(uint64_t const *_query, uint32_t _words, uint64_t const *_hashes, size_t _count, uint32_t *_distances)
+    {
+        size_t h = 0;
+
+        if (_words == 1)
+        {
+            // one word per hash: every vector lane holds a whole card
+            __m256i const query = _mm256_set1_epi64x((long long)_query[0]);
+            __m256i const pack  = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+            for (; h + 4 <= _count; h += 4)
+            {
+                __m256i const hashes = _mm256_loadu_si256((__m256i const *)(_hashes + h));
+                __m256i const dist   = _mm256_permutevar8x32_epi32(popCount256(_mm256_xor_si256(hashes, query)), pack);
+                _mm_storeu_si128((__m128i *)(_distances + h), _mm256_castsi256_si128(dist));
+            }
+        }
+        else if (_words % 4 == 0)
+        {
+            // wide hashes: accumulate 256 bits at a time, then reduce the lanes once per card
+            for (; h < _count; h++)
+            {
+                uint64_t const *hash = _hashes + h * _words;
+
+                __m256i acc = _mm256_setzero_si256();
+                for (uint32_t w = 0; w < _words; w += 4)
+                {
+                    __m256i const q = _mm256_loadu_si256((__m256i const *)(_query + w));
+                    __m256i const v = _mm256_loadu_si256((__m256i const *)(hash + w));
+                    acc = _mm256_add_epi64(acc, popCount256(_mm256_xor_si256(q, v)));
+                }
+
+                __m128i const sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+                _distances[h] = (uint32_t)(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+            }
+        }
+
+        return h;
+    }
+#endif
+}
+
+void mtg::scanHammingDistances(uint64_t const *_query, uint32_t _words, uint64_t const *_hashes, size_t _count, uint32_t *_distances)
+{
+    size_t h = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    // only with MTG_NATIVE_ARCH on a host that has it, the binary then requires it too
+    if (_words == 1)
+    {
+        __m512i const query = _mm512_set1_epi64((long long)_query[0]);
+        for (; h + 8 <= _count; h += 8)
+        {
+            __m512i const hashes = _mm512_loadu_si512((void const *)(_hashes + h));
+            __m512i const dist   = _mm512_popcnt_epi64(_mm512_xor_si512(hashes, query));
+            _mm256_storeu_si256((__m256i *)(_distances + h), _mm512_cvtepi64_epi32(dist));
+        }
+    }
+#endif
+
+#if defined(MTG_X86_DISPATCH)
+    if (h == 0 && hasAvx2())
+    {
+        h = scanAvx2(_query, _words, _hashes, _count, _distances);
+    }
+#endif
+
+    // whatever the vector paths did not cover
+    scanScalar(_query, _words, _hashes, h, _count, _distances);
+}
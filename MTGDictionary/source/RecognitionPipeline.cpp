@@ -0,0 +1,341 @@
+//! ----------------------------------------------------------------------------
+//! RecognitionPipeline.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "RecognitionPipeline.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "Log.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    //! Feeds the scanner from the capture queue, exhausted once the queue is closed and drained.
+    //! Frames keep their capture time, so latency includes the wait in the queue.
+    class QueueFrameSource : public mtg::FrameSource
+    {
+    public:
+        QueueFrameSource(mtg::BoundedQueue<mtg::FramePtr> &_frames) :
+            mFrames(_frames),
+            mTimestampMicroseconds(0)
+        {
+        }
+
+    public:
+        virtual bool read(cv::Mat &_frame)
+        {
+            mtg::FramePtr captured;
+            if (!mFrames.pop(captured))
+            {
+                return false;
+            }
+
+            // into the scanner's pooled buffer, the captured one goes back to its pool on return
+            captured->color.copyTo(_frame);
+            mTimestampMicroseconds = captured->timestampMicroseconds;
+            return true;
+        }
+
+        virtual int64_t getFrameTimestamp() const
+        {
+            return mTimestampMicroseconds;
+        }
+
+    private:
+        mtg::BoundedQueue<mtg::FramePtr> &mFrames;
+        int64_t mTimestampMicroseconds;
+    };
+
+    mtg::ScannerOptions getScannerOptions(mtg::PipelineOptions const &_options)
+    {
+        // capture is a stage of its own
+        mtg::ScannerOptions options = _options.scanner;
+        options.threadedCapture = false;
+        return options;
+    }
+
+    int64_t getMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+mtg::PipelineOptions::PipelineOptions() :
+    queueCapacity(4),
+    dropFrames(false)
+{
+}
+
+mtg::RecognitionPipeline::RecognitionPipeline(mtg::FrameSource *_source, mtg::CardCatalog const &_catalog, mtg::PipelineOptions const &_options) :
+    mSource(_source),
+    mOptions(_options),
+    mCapturePool(_options.queueCapacity + 2),
+    mFrames(_options.queueCapacity),
+    mQuads(_options.queueCapacity),
+    mCards(_options.queueCapacity),
+    mHashes(_options.queueCapacity),
+    mRecognitions(_options.queueCapacity),
+    mScannerSource(new QueueFrameSource(mFrames)),
+    mScanner(mScannerSource.get(), getScannerOptions(_options)),
+    mRecognizer(_catalog),
+    mRunning(false),
+    mDecidedCardId(0),
+    mCaptureMicroseconds(0),
+    mScanMicroseconds(0),
+    mRectifyMicroseconds(0),
+    mHashMicroseconds(0),
+    mMatchMicroseconds(0),
+    mSkippedFrames(0)
+{
+    std::memset(&mScannerStats, 0, sizeof(mScannerStats));
+}
+
+mtg::RecognitionPipeline::~RecognitionPipeline()
+{
+    stop();
+}
+
+void mtg::RecognitionPipeline::start()
+{
+    if (mRunning)
+    {
+        return;
+    }
+
+    mRunning = true;
+    mCaptureThread = std::thread(&mtg::RecognitionPipeline::captureLoop, this);
+    mScanThread = std::thread(&mtg::RecognitionPipeline::scanLoop, this);
+    mRectifyThread = std::thread(&mtg::RecognitionPipeline::rectifyLoop, this);
+    mHashThread = std::thread(&mtg::RecognitionPipeline::hashLoop, this);
+    mMatchThread = std::thread(&mtg::RecognitionPipeline::matchLoop, this);
+}
+
+void mtg::RecognitionPipeline::stop()
+{
+    // closing every queue wakes whichever stage is waiting on one, each then winds down
+    mRunning = false;
+    mFrames.close();
+    mQuads.close();
+    mCards.close();
+    mHashes.close();
+    mRecognitions.close();
+
+    std::thread *threads[] = { &mCaptureThread, &mScanThread, &mRectifyThread, &mHashThread, &mMatchThread };
+    for (int32_t t = 0; t < 5; t++)
+    {
+        if (threads[t]->joinable())
+        {
+            threads[t]->join();
+        }
+    }
+}
+
+bool mtg::RecognitionPipeline::popRecognition(mtg::Recognition &_recognition)
+{
+    return mRecognitions.pop(_recognition);
+}
+
+bool mtg::RecognitionPipeline::tryPopRecognition(mtg::Recognition &_recognition)
+{
+    return mRecognitions.tryPop(_recognition);
+}
+
+bool mtg::RecognitionPipeline::isFinished() const
+{
+    return mRecognitions.isClosed() && mRecognitions.getStats().depth == 0;
+}
+
+mtg::FramePtr mtg::RecognitionPipeline::getLatestFrame() const
+{
+    std::unique_lock<std::mutex> lock(mLatestMutex);
+    return mLatestFrame;
+}
+
+mtg::PipelineStats mtg::RecognitionPipeline::getStats() const
+{
+    mtg::PipelineStats stats;
+    stats.frames = mFrames.getStats();
+    stats.quads = mQuads.getStats();
+    stats.cards = mCards.getStats();
+    stats.hashes = mHashes.getStats();
+    stats.recognitions = mRecognitions.getStats();
+    stats.captureMicroseconds = mCaptureMicroseconds;
+    stats.scanMicroseconds = mScanMicroseconds;
+    stats.rectifyMicroseconds = mRectifyMicroseconds;
+    stats.hashMicroseconds = mHashMicroseconds;
+    stats.matchMicroseconds = mMatchMicroseconds;
+    stats.numSkippedFrames = mSkippedFrames;
+
+    std::unique_lock<std::mutex> lock(mLatestMutex);
+    stats.scanner = mScannerStats;
+    stats.detectors = mDetectorStats;
+    return stats;
+}
+
+void mtg::RecognitionPipeline::captureLoop()
+{
+    while (mRunning)
+    {
+        // the frames still queued keep their buffers, a free one is filled in place
+        mtg::FramePtr frame = mCapturePool.acquire();
+        int64_t const start = getMicroseconds();
+        bool const captured = mSource->read(frame->color);
+        frame->timestampMicroseconds = getMicroseconds();
+        mCaptureMicroseconds += frame->timestampMicroseconds - start;
+
+        if (!captured)
+        {
+            mtg_info("Frame source is exhausted, ending capture.");
+            break;
+        }
+
+        bool const queued = mOptions.dropFrames ? mFrames.pushLatest(frame) : mFrames.push(frame);
+        if (!queued)
+        {
+            break;
+        }
+    }
+
+    mFrames.close();
+}
+
+void mtg::RecognitionPipeline::scanLoop()
+{
+    ScannedFrame scanned;
+    while (mRunning)
+    {
+        int64_t const start = getMicroseconds();
+        mScanner.checkForQuads(scanned.quads, scanned.image);
+        mScanMicroseconds += getMicroseconds() - start;
+
+        if (mScanner.isFinished())
+        {
+            break;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mLatestMutex);
+            mLatestFrame = scanned.image;
+            mScannerStats = mScanner.getStats();
+            mDetectorStats = mScanner.getDetectorStats();
+        }
+
+        if (scanned.quads.empty())
+        {
+            continue;
+        }
+
+        // cards the match stage already settled, every slot of them, need no further snapshots
+        scanned.cardId = mScanner.getCardId();
+        if (scanned.cardId == mDecidedCardId)
+        {
+            mSkippedFrames++;
+            continue;
+        }
+
+        scanned.frame = mScanner.getStats().numFrames;
+        if (!mQuads.push(scanned))
+        {
+            break;
+        }
+    }
+
+    mQuads.close();
+}
+
+void mtg::RecognitionPipeline::rectifyLoop()
+{
+    ScannedFrame scanned;
+    while (mQuads.pop(scanned))
+    {
+        int64_t const start = getMicroseconds();
+
+        RectifiedFrame rectified;
+        rectified.frame = scanned.frame;
+        rectified.cardId = scanned.cardId;
+        rectified.cards.resize(scanned.quads.size());
+
+        cv::Mat const &color = scanned.image->color;
+        mtg::ThreadPool::getGlobalPool().parallelFor(scanned.quads.size(), [&](uint32_t _q) {
+            mtg::rectifyCard(color, scanned.quads.at(_q), rectified.cards.at(_q));
+        });
+
+        // hand the pooled frame back to the scanner before waiting on the hash stage
+        scanned.image.reset();
+        mRectifyMicroseconds += getMicroseconds() - start;
+
+        if (!mCards.push(rectified))
+        {
+            break;
+        }
+    }
+
+    mCards.close();
+}
+
+void mtg::RecognitionPipeline::hashLoop()
+{
+    RectifiedFrame rectified;
+    while (mCards.pop(rectified))
+    {
+        int64_t const start = getMicroseconds();
+
+        HashedFrame hashed;
+        hashed.frame = rectified.frame;
+        hashed.cardId = rectified.cardId;
+        hashed.cards.swap(rectified.cards);
+        mtg::CardRecognizer::hashSnapshots(hashed.cards, hashed.hashes, hashed.colorHashes);
+
+        mHashMicroseconds += getMicroseconds() - start;
+
+        if (!mHashes.push(hashed))
+        {
+            break;
+        }
+    }
+
+    mHashes.close();
+}
+
+void mtg::RecognitionPipeline::matchLoop()
+{
+    HashedFrame hashed;
+    std::vector<mtg::Recognition> recognized;
+    while (mHashes.pop(hashed))
+    {
+        int64_t const start = getMicroseconds();
+
+        recognized.clear();
+        mRecognizer.addSnapshots(hashed.frame, hashed.cardId, hashed.cards, hashed.hashes, hashed.colorHashes, recognized);
+        if (!mRecognizer.needsSnapshots(hashed.cardId))
+        {
+            mDecidedCardId = hashed.cardId;
+        }
+
+        mMatchMicroseconds += getMicroseconds() - start;
+
+        bool open = true;
+        for (int32_t r = 0; r < (int32_t)recognized.size() && open; r++)
+        {
+            open = mRecognitions.push(recognized.at(r));
+        }
+
+        if (!open)
+        {
+            break;
+        }
+    }
+
+    mtg_debug("Recognized " << mRecognizer.getNumRecognized() << " cards, " << mRecognizer.getFramesPerDecision() << " frames per decision");
+    mRecognitions.close();
+}
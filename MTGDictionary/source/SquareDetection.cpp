@@ -11,7 +11,172 @@
 
 #include "SquareDetection.h"
 
+#include <atomic>
+#include <cmath>
+
 #include "Log.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    //! Smallest square findSquares reports, in pixels of the image it searches
+    float const kMinSquareArea = 1000.f;
+
+    //! A square is kept if every corner is within this cosine of a right angle
+    float const kMaxSquareCosine = 0.3f;
+
+    //! Half size of the full resolution window a coarse corner is refined in, per unit of scale
+    int32_t const kRefineWindowPerScale = 2;
+
+    //! A square whose corners all bend less than this (cosine) is taken as a card outright
+    float const kConfidentCosine = 0.1f;
+
+    //! A square covering this much of the image is its border, not a card
+    float const kMaxImageShare = 0.95f;
+
+    //! Squares whose corners are all this close, relative to the image size, are the same square
+    float const kDuplicateShare = 0.01f;
+    float const kMinDuplicateDistance = 2.f;
+
+    //! Thresholds one color plane at one level and appends the squares larger than _minArea
+    //! to _squares, together with the largest cosine between the sides of each of them
+    void findSquaresInPlane(cv::Mat const &_plane, int32_t _threshold, int32_t _levels, int32_t _level, float _minArea, mtg::SquaresVector &_squares, std::vector<float> &_cosines)
+    {
+        cv::Mat gray;
+
+        // use canny instead on zero threshold level
+        // helps to catch squares with gradient shading
+        if (_level == 0)
+        {
+            cv::Canny(_plane, gray, 0, _threshold, 5);
+            cv::dilate(gray, gray, cv::Mat(), cv::Point(-1, -1));
+        }
+        else
+        {
+            gray = _plane >= (_level + 1) * 255 / _levels;
+        }
+
+        // detect contours on the image
+        mtg::SquaresVector contours;
+        cv::findContours(gray, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+        mtg::Square approx;
+        for (int32_t idx = 0; idx < (int32_t)contours.size(); idx++)
+        {
+            // approximate contour with accuracy proportional to the contour perimeter
+            cv::approxPolyDP(cv::Mat(contours[idx]), approx, cv::arcLength(cv::Mat(contours[idx]), true) * 0.02f, true);
+
+            // square contours should have 4 vertices, have a relatively large area, and be convex
+            if (approx.size() == 4 && std::fabs(cv::contourArea(cv::Mat(approx))) > _minArea && cv::isContourConvex(cv::Mat(approx)))
+            {
+                float maxCosine = 0.f;
+
+                for (int32_t jdx = 2; jdx < 5; jdx++)
+                {
+                    // find the maximum cosine of the angle between joint edges
+                    float const cosine = std::fabs(mtg::getAngleBetweenVectors(approx[jdx % 4], approx[jdx - 2], approx[jdx - 1]));
+                    maxCosine = std::max(cosine, maxCosine);
+                }
+
+                // if cosines of all angles are small (~90 degrees)
+                if (maxCosine < kMaxSquareCosine)
+                {
+                    mtg::reorderSquareVertices(approx);
+                    _squares.push_back(approx);
+                    _cosines.push_back(maxCosine);
+                }
+            }
+        }
+    }
+
+    //! findSquaresInPlane's checks for a square with subpixel corners: convex, larger than _minArea
+    //! and every corner within the same cosine of a right angle
+    bool isSubpixelSquare(mtg::SubpixelSquare const &_square, float _minArea)
+    {
+        if (!cv::isContourConvex(cv::Mat(_square)) || std::fabs(cv::contourArea(cv::Mat(_square))) <= _minArea)
+        {
+            return false;
+        }
+
+        for (int32_t pt = 0; pt < 4; pt++)
+        {
+            cv::Point2f const previous = _square.at((pt + 3) % 4) - _square.at(pt);
+            cv::Point2f const next = _square.at((pt + 1) % 4) - _square.at(pt);
+            if (std::fabs(previous.dot(next)) >= kMaxSquareCosine * std::sqrt(previous.dot(previous) * next.dot(next) + 1e-10f))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //! Both squares are ordered { TL, BL, BR, TR }, so corresponding corners can be compared directly
+    bool isSameSquare(mtg::Square const &_square0, mtg::Square const &_square1, float _tolerance)
+    {
+        for (int32_t pt = 0; pt < 4; pt++)
+        {
+            cv::Point const d = _square0.at(pt) - _square1.at(pt);
+            if (d.x * d.x + d.y * d.y > _tolerance * _tolerance)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //! Searches every (plane, level) pair in parallel and merges their squares, dropping copies
+    void searchPlanes(std::vector<cv::Mat> const &_planes, int32_t _threshold, int32_t _levels, float _minArea, bool _stopEarly, mtg::SquaresVector &_squares)
+    {
+        // level major, so the canny pass of every plane, the most likely to find the card, goes first
+        uint32_t const numPlanes = _planes.size();
+        uint32_t const numItems = numPlanes * _levels;
+        std::vector<mtg::SquaresVector> found(numItems);
+        std::vector< std::vector<float> > cosines(numItems);
+
+        float const maxArea = kMaxImageShare * _planes.at(0).size().area();
+        std::atomic<bool> confident(false);
+        mtg::ThreadPool::getGlobalPool().parallelFor(numItems, [&](uint32_t _item) {
+            if (_stopEarly && confident)
+            {
+                return;
+            }
+
+            // every item has its own threshold image, contours and output, nothing is shared while it runs
+            findSquaresInPlane(_planes.at(_item % numPlanes), _threshold, _levels, _item / numPlanes, _minArea, found.at(_item), cosines.at(_item));
+
+            for (int32_t sq = 0; sq < (int32_t)found.at(_item).size() && _stopEarly; sq++)
+            {
+                if (cosines.at(_item).at(sq) < kConfidentCosine && std::fabs(cv::contourArea(cv::Mat(found.at(_item).at(sq)))) < maxArea)
+                {
+                    confident = true;
+                }
+            }
+        });
+
+        // merge in work item order, so the result does not depend on the scheduling
+        float const tolerance = std::max(kMinDuplicateDistance, kDuplicateShare * std::sqrt(float(_planes.at(0).size().area())));
+        for (uint32_t item = 0; item < numItems; item++)
+        {
+            for (int32_t sq = 0; sq < (int32_t)found.at(item).size(); sq++)
+            {
+                mtg::Square const &square = found.at(item).at(sq);
+
+                bool duplicate = false;
+                for (int32_t other = 0; other < (int32_t)_squares.size() && !duplicate; other++)
+                {
+                    duplicate = isSameSquare(square, _squares.at(other), tolerance);
+                }
+
+                if (!duplicate)
+                {
+                    _squares.push_back(square);
+                }
+            }
+        }
+    }
+}
 
 float mtg::getAngleBetweenVectors(cv::Point pt1, cv::Point pt2, cv::Point pt0)
 {
@@ -32,8 +197,8 @@ void mtg::findSquares(cv::Mat const &input_image, int32_t threshold, int32_t lev
 {
     squares.clear();
 
-    mtg::SquaresVector contours;
-    cv::Mat pyr, tempImage, gray, gray0(input_image.size(), CV_8U);
+    cv::Mat pyr, tempImage, gray0(input_image.size(), CV_8U);
+    std::vector<float> cosines;
 
     // downscale and upscale the image to filter out noise
     cv::pyrDown(input_image, pyr, cv::Size(input_image.size().width / 2, input_image.size().height / 2));
@@ -48,47 +213,91 @@ void mtg::findSquares(cv::Mat const &input_image, int32_t threshold, int32_t lev
         // try several threshold levels
         for (int32_t lvl = 0; lvl < levels; lvl++)
         {
-            // use canny instead on zero threshold level
-            // helps to catch squares with gradient shading
-            if (lvl == 0)
-            {
-                cv::Canny(gray0, gray, 0, threshold, 5);
-                cv::dilate(gray, gray, cv::Mat(), cv::Point(-1, -1));
-            }
-            else
-            {
-                gray = gray0 >= (lvl + 1) * 255 / levels;
-            }
+            findSquaresInPlane(gray0, threshold, levels, lvl, kMinSquareArea, squares, cosines);
+        }
+    }
+}
 
-            // detect contours on the image
-            cv::findContours(gray, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+void mtg::findSquaresParallel(cv::Mat const &input_image, int32_t threshold, int32_t levels, mtg::SquaresVector &squares, bool stop_early)
+{
+    squares.clear();
 
-            mtg::Square approx;
-            for (int32_t idx = 0; idx < (int32_t)contours.size(); idx++)
-            {
-                // approximate contour with accuracy proportional to the contour perimeter
-                cv::approxPolyDP(cv::Mat(contours[idx]), approx, cv::arcLength(cv::Mat(contours[idx]), true) * 0.02f, true);
+    // downscale and upscale the image to filter out noise
+    cv::Mat pyr, tempImage;
+    cv::pyrDown(input_image, pyr, cv::Size(input_image.size().width / 2, input_image.size().height / 2));
+    cv::pyrUp(pyr, tempImage, input_image.size());
+
+    std::vector<cv::Mat> planes;
+    cv::split(tempImage, planes);
+
+    searchPlanes(planes, threshold, levels, kMinSquareArea, stop_early, squares);
+}
+
+void mtg::findSquaresCoarseToFine(cv::Mat const &input_image, int32_t threshold, int32_t levels, int32_t pyramid_levels, mtg::SubpixelSquaresVector &squares, bool stop_early)
+{
+    squares.clear();
+
+    // every pyrDown quarters the pixels and smooths as well, so no separate denoising pass is needed
+    cv::Mat coarse = input_image;
+    int32_t scale = 1;
+    for (int32_t lvl = 0; lvl < pyramid_levels && coarse.cols >= 64 && coarse.rows >= 64; lvl++)
+    {
+        cv::Mat down;
+        cv::pyrDown(coarse, down, cv::Size((coarse.cols + 1) / 2, (coarse.rows + 1) / 2));
+        coarse = down;
+        scale *= 2;
+    }
+
+    std::vector<cv::Mat> planes;
+    cv::split(coarse, planes);
+
+    // the minimum area shrinks with the image so the same cards qualify at every level
+    mtg::SquaresVector coarseSquares;
+    searchPlanes(planes, threshold, levels, kMinSquareArea / float(scale * scale), stop_early, coarseSquares);
 
-                // square contours should have 4 vertices, have a relatively large area, and be convex
-                if (approx.size() == 4 && std::fabs(cv::contourArea(cv::Mat(approx))) > 1000 && cv::isContourConvex(cv::Mat(approx)))
+    // each coarse corner is only known to within a coarse pixel, pin it down at full resolution
+    // in a window just large enough to cover that uncertainty
+    int32_t const halfWindow = kRefineWindowPerScale * scale;
+    cv::Size const window(halfWindow, halfWindow);
+    cv::TermCriteria const criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03);
+    cv::Rect const bounds(0, 0, input_image.cols, input_image.rows);
+
+    cv::Mat gray;
+    for (int32_t sq = 0; sq < (int32_t)coarseSquares.size(); sq++)
+    {
+        mtg::SubpixelSquare square(4);
+        for (int32_t pt = 0; pt < 4; pt++)
+        {
+            cv::Point2f const corner = cv::Point2f(coarseSquares.at(sq).at(pt)) * float(scale) + cv::Point2f(0.5f, 0.5f) * float(scale - 1);
+
+            // the window plus the margin cornerSubPix samples around it, clipped to the image
+            cv::Point const center(cvRound(corner.x), cvRound(corner.y));
+            int32_t const margin = 2 * halfWindow + 2;
+            cv::Rect const roi = cv::Rect(center.x - margin, center.y - margin, 2 * margin + 1, 2 * margin + 1) & bounds;
+
+            std::vector<cv::Point2f> refined(1, corner - cv::Point2f(roi.tl()));
+            if (roi.width > 2 * halfWindow + 4 && roi.height > 2 * halfWindow + 4)
+            {
+                if (input_image.channels() == 3)
                 {
-                    float maxCosine = 0.f;
-
-                    for (int32_t jdx = 2; jdx < 5; jdx++)
-                    {
-                        // find the maximum cosine of the angle between joint edges
-                        float const cosine = std::fabs(mtg::getAngleBetweenVectors(approx[jdx % 4], approx[jdx - 2], approx[jdx - 1]));
-                        maxCosine = std::max(cosine, maxCosine);
-                    }
-
-                    // if cosines of all angles are small (~90 degrees)
-                    if (maxCosine < 0.3f)
-                    {
-                        mtg::reorderSquareVertices(approx);
-                        squares.push_back(approx);
-                    }
+                    cv::cvtColor(input_image(roi), gray, CV_BGR2GRAY);
                 }
+                else
+                {
+                    gray = input_image(roi);
+                }
+
+                cv::cornerSubPix(gray, refined, window, cv::Size(-1, -1), criteria);
             }
+
+            square.at(pt) = refined.front() + cv::Point2f(roi.tl());
+        }
+
+        // every corner moved by at most a window, so the coarse { TL, BL, BR, TR } order still holds,
+        // but a corner pulled onto a neighbouring edge can leave a quad that is no card
+        if (isSubpixelSquare(square, kMinSquareArea))
+        {
+            squares.push_back(square);
         }
     }
 }
@@ -165,14 +374,14 @@ void mtg::warpImage(mtg::Square const &rect, cv::Mat const &input_image, cv::Mat
     cv::Point2f topRight    = rect.at(3);
 
     // gather target width and height based on rect dimensions
-    float const width0  = std::sqrt(std::powf(bottomRight.x - bottomLeft.x, 2.f) + std::powf(bottomRight.y - bottomLeft.y, 2.f));
-    float const width1  = std::sqrt(std::powf(topRight.x - topLeft.x, 2.f) + std::powf(topRight.y - topLeft.y, 2.f));
-    float const height0 = std::sqrt(std::powf(topRight.x - bottomRight.x, 2.f) + std::powf(topRight.y - bottomRight.y, 2.f));
-    float const height1 = std::sqrt(std::powf(topLeft.x - bottomLeft.x, 2.f) + std::powf(topLeft.y - bottomLeft.y, 2.f));
+    float const width0  = (float)cv::norm(bottomRight - bottomLeft);
+    float const width1  = (float)cv::norm(topRight - topLeft);
+    float const height0 = (float)cv::norm(topRight - bottomRight);
+    float const height1 = (float)cv::norm(topLeft - bottomLeft);
 
     // NOTE: why is this transposed?
-    int32_t const maxWidth = std::roundf(std::max(height0, height1));
-    int32_t const maxHeight = std::roundf(std::max(width0, width1));
+    int32_t const maxWidth = std::round(std::max(height0, height1));
+    int32_t const maxHeight = std::round(std::max(width0, width1));
 
     std::vector<cv::Point2f> sourceRect;
     sourceRect.push_back(topLeft);
@@ -0,0 +1,168 @@
+//! ----------------------------------------------------------------------------
+//! ThreadPool.cpp
+//!
+//! MTGDictionary is licensed under a
+//! Creative Commons Attribution-NonCommercial 4.0 International License.
+//! You should have received a copy of the license along with this
+//! work. If not, see http://creativecommons.org/licenses/by-nc-sa/4.0/.
+//!
+//! (c) Copyright Dustin Hopper 2015 - hopper.dustin@gmail.com
+//! ----------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+    //! Set on pool workers and on a caller while it runs iterations, nested loops run serially
+    thread_local bool tInsideParallelFor = false;
+}
+
+mtg::ThreadPool::ThreadPool(uint32_t _numThreads) :
+    mShutdown(false)
+{
+    uint32_t numThreads = _numThreads;
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // the calling thread is one of the workers
+    for (uint32_t t = 1; t < numThreads; t++)
+    {
+        mWorkers.push_back(std::thread(&mtg::ThreadPool::workerLoop, this));
+    }
+}
+
+mtg::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWakeCondition.notify_all();
+
+    for (int32_t w = 0; w < (int32_t)mWorkers.size(); w++)
+    {
+        mWorkers.at(w).join();
+    }
+}
+
+void mtg::ThreadPool::parallelFor(uint32_t _count, std::function<void(uint32_t)> const &_body)
+{
+    if (_count == 0)
+    {
+        return;
+    }
+
+    if (tInsideParallelFor || mWorkers.empty() || _count == 1)
+    {
+        for (uint32_t i = 0; i < _count; i++)
+        {
+            _body(i);
+        }
+        return;
+    }
+
+    mtg::ThreadPool::Job job;
+    job.body = &_body;
+    job.count = _count;
+    job.next = 0;
+    job.numWorkers = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(&job);
+    }
+    mWakeCondition.notify_all();
+
+    // runIterations catches what _body throws, so the flag is always reset
+    tInsideParallelFor = true;
+    runIterations(job);
+    tInsideParallelFor = false;
+
+    {
+        // once the job is off the queue no worker can pick it up, wait for the ones still inside
+        std::unique_lock<std::mutex> lock(mMutex);
+        removeJob(&job);
+        mDoneCondition.wait(lock, [&job]() { return job.numWorkers == 0; });
+    }
+
+    if (job.error)
+    {
+        std::rethrow_exception(job.error);
+    }
+}
+
+uint32_t mtg::ThreadPool::getNumThreads() const
+{
+    return mWorkers.size() + 1;
+}
+
+mtg::ThreadPool &mtg::ThreadPool::getGlobalPool()
+{
+    static mtg::ThreadPool pool;
+    return pool;
+}
+
+void mtg::ThreadPool::workerLoop()
+{
+    tInsideParallelFor = true;
+
+    while (true)
+    {
+        mtg::ThreadPool::Job *job = NULL;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeCondition.wait(lock, [this]() { return mShutdown || !mJobs.empty(); });
+            if (mShutdown)
+            {
+                return;
+            }
+            job = mJobs.front();
+            job->numWorkers++;
+        }
+
+        runIterations(*job);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        // every iteration is handed out, let the workers move on to the next job
+        removeJob(job);
+        if (--job->numWorkers == 0)
+        {
+            mDoneCondition.notify_all();
+        }
+    }
+}
+
+void mtg::ThreadPool::runIterations(mtg::ThreadPool::Job &_job)
+{
+    uint32_t i;
+    while ((i = _job.next.fetch_add(1)) < _job.count)
+    {
+        try
+        {
+            (*_job.body)(i);
+        }
+        catch (...)
+        {
+            // keep the first exception and hand out no further iterations
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!_job.error)
+            {
+                _job.error = std::current_exception();
+            }
+            _job.next = _job.count;
+        }
+    }
+}
+
+void mtg::ThreadPool::removeJob(mtg::ThreadPool::Job const *_job)
+{
+    std::deque<mtg::ThreadPool::Job *>::iterator it = std::find(mJobs.begin(), mJobs.end(), _job);
+    if (it != mJobs.end())
+    {
+        mJobs.erase(it);
+    }
+}